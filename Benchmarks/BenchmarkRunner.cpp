@@ -0,0 +1,421 @@
+// BenchmarkRunner.cpp : Minimal benchmark harness with Google Benchmark style output.
+//
+
+#include "BenchmarkRunner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <regex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct RegisteredBenchmark {
+  std::string name;
+  double bytes;
+  double items;
+  BenchmarkFactory factory;
+};
+
+struct BenchmarkResult {
+  std::string name;
+  long long iterations;
+  double real_ns; // per iteration
+  double cpu_ns;  // per iteration, all threads of the process
+  double bytes;
+  double items;
+  std::vector<double> counters; // per iteration, in the order of --benchmark_perf_counters
+};
+
+// Hardware event counters of the calling thread, named like the generic perf
+// events. Work handed to other threads is not counted, so they are meant for
+// single-threaded benchmarks.
+class PerfCounters {
+  std::vector<std::string> names;
+  std::vector<int> fds;
+
+public:
+  PerfCounters() {
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (size_t i = 0; i < fds.size(); i++) {
+      close(fds[i]);
+    }
+#endif
+  }
+
+  // Opens the counter, returns false if it is unknown or the system doesn't
+  // let the process count it.
+  bool Add(const std::string& name) {
+#ifdef __linux__
+    static const struct {
+      const char* name;
+      uint32_t type;
+      uint64_t config;
+    } events[] = {
+      { "CYCLES", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { "INSTRUCTIONS", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { "CACHE-REFERENCES", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+      { "CACHE-MISSES", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+      { "L1D-LOAD-MISSES", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+      { "LLC-LOAD-MISSES", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+      if (name != events[i].name) {
+        continue;
+      }
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[i].type;
+      attr.config = events[i].config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd < 0) {
+        return false;
+      }
+      names.push_back(name);
+      fds.push_back(fd);
+      return true;
+    }
+#else
+    (void)name;
+#endif
+    return false;
+  }
+
+  const std::vector<std::string>& GetNames() const {
+    return names;
+  }
+
+  void Start() {
+#ifdef __linux__
+    for (size_t i = 0; i < fds.size(); i++) {
+      ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  // Stops counting and returns the events since Start.
+  std::vector<double> Stop() {
+    std::vector<double> values(fds.size());
+#ifdef __linux__
+    for (size_t i = 0; i < fds.size(); i++) {
+      ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t value = 0;
+      if (read(fds[i], &value, sizeof(value)) == sizeof(value)) {
+        values[i] = (double)value;
+      }
+    }
+#endif
+    return values;
+  }
+
+private:
+  PerfCounters(const PerfCounters&);
+  PerfCounters& operator=(const PerfCounters&);
+};
+
+std::vector<RegisteredBenchmark>& Registry() {
+  static std::vector<RegisteredBenchmark> benchmarks;
+  return benchmarks;
+}
+
+// Calls body iterations times, returns the wall clock and process CPU time
+// spent in seconds and the counted events.
+void TimeIterations(
+  const std::function<void()>& body,
+  long long iterations,
+  PerfCounters& perf_counters,
+  double& real,
+  double& cpu,
+  std::vector<double>& counters
+  ) {
+  std::clock_t cpu_start = std::clock();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  perf_counters.Start();
+  for (long long i = 0; i < iterations; i++) {
+    body();
+  }
+  counters = perf_counters.Stop();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  std::clock_t cpu_end = std::clock();
+  real = std::chrono::duration<double>(end - start).count();
+  cpu = (double)(cpu_end - cpu_start) / CLOCKS_PER_SEC;
+}
+
+BenchmarkResult Run(const RegisteredBenchmark& benchmark, double min_time, PerfCounters& perf_counters) {
+  std::function<void()> body = benchmark.factory();
+
+  // one untimed call to fault in the buffers and fill the caches
+  body();
+
+  // grow the iteration count like Google Benchmark until the run is long
+  // enough to trust
+  long long iterations = 1;
+  double real = 0;
+  double cpu = 0;
+  std::vector<double> counters;
+  for (;;) {
+    TimeIterations(body, iterations, perf_counters, real, cpu, counters);
+    if (real >= min_time || iterations >= 1000000000LL) {
+      break;
+    }
+    double multiplier = real > 0 ? min_time * 1.4 / real : 10;
+    if (multiplier > 10) {
+      multiplier = 10;
+    }
+    long long next = (long long)(iterations * multiplier);
+    iterations = next > iterations ? next : iterations + 1;
+  }
+
+  BenchmarkResult result;
+  result.name = benchmark.name;
+  result.iterations = iterations;
+  result.real_ns = real * 1e9 / iterations;
+  result.cpu_ns = cpu * 1e9 / iterations;
+  result.bytes = benchmark.bytes;
+  result.items = benchmark.items;
+  for (size_t i = 0; i < counters.size(); i++) {
+    result.counters.push_back(counters[i] / iterations);
+  }
+  return result;
+}
+
+std::string JsonEscape(const std::string& str) {
+  std::string out;
+  for (size_t i = 0; i < str.size(); i++) {
+    char c = str[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+void WriteJson(
+  FILE* file,
+  const char* executable,
+  const std::vector<std::string>& counter_names,
+  const std::vector<BenchmarkResult>& results
+  ) {
+  char date[64];
+  std::time_t now = std::time(NULL);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"context\": {\n");
+  fprintf(file, "    \"date\": \"%s\",\n", date);
+  fprintf(file, "    \"executable\": \"%s\",\n", JsonEscape(executable).c_str());
+  fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+  fprintf(file, "    \"library_build_type\": \"release\"\n");
+#else
+  fprintf(file, "    \"library_build_type\": \"debug\"\n");
+#endif
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchmarkResult& r = results[i];
+    double seconds = r.real_ns * 1e-9;
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"name\": \"%s\",\n", JsonEscape(r.name).c_str());
+    fprintf(file, "      \"run_name\": \"%s\",\n", JsonEscape(r.name).c_str());
+    fprintf(file, "      \"run_type\": \"iteration\",\n");
+    fprintf(file, "      \"iterations\": %lld,\n", r.iterations);
+    fprintf(file, "      \"real_time\": %.6e,\n", r.real_ns);
+    fprintf(file, "      \"cpu_time\": %.6e,\n", r.cpu_ns);
+    if (r.bytes > 0) {
+      fprintf(file, "      \"bytes_per_second\": %.6e,\n", r.bytes / seconds);
+    }
+    if (r.items > 0) {
+      fprintf(file, "      \"items_per_second\": %.6e,\n", r.items / seconds);
+    }
+    for (size_t c = 0; c < r.counters.size(); c++) {
+      fprintf(file, "      \"%s\": %.6e,\n", JsonEscape(counter_names[c]).c_str(), r.counters[c]);
+    }
+    fprintf(file, "      \"time_unit\": \"ns\"\n");
+    fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n");
+  fprintf(file, "}\n");
+}
+
+void PrintConsoleHeader(size_t name_width) {
+  printf("%-*s %15s %15s %12s\n", (int)name_width, "Benchmark", "Time", "CPU", "Iterations");
+  printf("%s\n", std::string(name_width + 45, '-').c_str());
+}
+
+void PrintConsoleResult(const std::vector<std::string>& counter_names, const BenchmarkResult& r, size_t name_width) {
+  printf("%-*s %12.0f ns %12.0f ns %12lld", (int)name_width, r.name.c_str(), r.real_ns, r.cpu_ns, r.iterations);
+  double seconds = r.real_ns * 1e-9;
+  if (r.bytes > 0) {
+    printf(" bytes_per_second=%.2fGi/s", r.bytes / seconds / (1024.0 * 1024.0 * 1024.0));
+  }
+  if (r.items > 0) {
+    printf(" items_per_second=%.3gM/s", r.items / seconds * 1e-6);
+  }
+  for (size_t c = 0; c < r.counters.size(); c++) {
+    printf(" %s=%.4g", counter_names[c].c_str(), r.counters[c]);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+bool ParseFlag(const char* arg, const char* flag, std::string& value) {
+  size_t len = strlen(flag);
+  if (strncmp(arg, flag, len) != 0 || arg[len] != '=') {
+    return false;
+  }
+  value = arg + len + 1;
+  return true;
+}
+
+} // namespace
+
+void RegisterBenchmark(const std::string& name, double bytes, double items, const BenchmarkFactory& factory) {
+  RegisteredBenchmark benchmark;
+  benchmark.name = name;
+  benchmark.bytes = bytes;
+  benchmark.items = items;
+  benchmark.factory = factory;
+  Registry().push_back(benchmark);
+}
+
+int RunBenchmarks(int argc, char** argv) {
+  std::string filter = ".";
+  std::string min_time_str = "0.5";
+  std::string out_file;
+  std::string format = "console";
+  std::string out_format = "json";
+  std::string perf_counter_names;
+  bool list_only = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string value;
+    if (ParseFlag(argv[i], "--benchmark_filter", value)) {
+      filter = value;
+    } else if (ParseFlag(argv[i], "--benchmark_min_time", value)) {
+      min_time_str = value;
+    } else if (ParseFlag(argv[i], "--benchmark_out", value)) {
+      out_file = value;
+    } else if (ParseFlag(argv[i], "--benchmark_out_format", value)) {
+      out_format = value;
+    } else if (ParseFlag(argv[i], "--benchmark_format", value)) {
+      format = value;
+    } else if (ParseFlag(argv[i], "--benchmark_perf_counters", value)) {
+      perf_counter_names = value;
+    } else if (strcmp(argv[i], "--benchmark_list_tests") == 0 ||
+               strcmp(argv[i], "--benchmark_list_tests=true") == 0) {
+      list_only = true;
+    } else {
+      fprintf(stderr,
+        "usage: %s [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>]\n"
+        "       [--benchmark_format=console|json] [--benchmark_out=<file>]\n"
+        "       [--benchmark_out_format=json] [--benchmark_list_tests]\n"
+        "       [--benchmark_perf_counters=<event>,...]\n",
+        argv[0]);
+      return 1;
+    }
+  }
+
+  double min_time = atof(min_time_str.c_str());
+  if (min_time <= 0 || (format != "console" && format != "json") || out_format != "json") {
+    fprintf(stderr, "%s: invalid flag value\n", argv[0]);
+    return 1;
+  }
+
+  // e.g. CACHE-MISSES,INSTRUCTIONS
+  PerfCounters perf_counters;
+  size_t name_begin = 0;
+  while (name_begin < perf_counter_names.size()) {
+    size_t name_end = perf_counter_names.find(',', name_begin);
+    if (name_end == std::string::npos) {
+      name_end = perf_counter_names.size();
+    }
+    std::string name = perf_counter_names.substr(name_begin, name_end - name_begin);
+    if (!perf_counters.Add(name)) {
+      fprintf(stderr, "%s: unable to count %s on this system\n", argv[0], name.c_str());
+      return 1;
+    }
+    name_begin = name_end + 1;
+  }
+
+  std::regex filter_regex;
+  try {
+    filter_regex = std::regex(filter);
+  } catch (const std::regex_error&) {
+    fprintf(stderr, "%s: invalid --benchmark_filter regex\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<const RegisteredBenchmark*> selected;
+  size_t name_width = 10;
+  for (size_t i = 0; i < Registry().size(); i++) {
+    if (std::regex_search(Registry()[i].name, filter_regex)) {
+      selected.push_back(&Registry()[i]);
+      if (Registry()[i].name.size() > name_width) {
+        name_width = Registry()[i].name.size();
+      }
+    }
+  }
+
+  if (list_only) {
+    for (size_t i = 0; i < selected.size(); i++) {
+      printf("%s\n", selected[i]->name.c_str());
+    }
+    return 0;
+  }
+
+  bool console = (format == "console");
+  if (console) {
+    PrintConsoleHeader(name_width);
+  }
+
+  std::vector<BenchmarkResult> results;
+  for (size_t i = 0; i < selected.size(); i++) {
+    results.push_back(Run(*selected[i], min_time, perf_counters));
+    if (console) {
+      PrintConsoleResult(perf_counters.GetNames(), results.back(), name_width);
+    }
+  }
+
+  if (!console) {
+    WriteJson(stdout, argv[0], perf_counters.GetNames(), results);
+  }
+  if (!out_file.empty()) {
+    FILE* file = fopen(out_file.c_str(), "w");
+    if (file == NULL) {
+      fprintf(stderr, "%s: unable to open %s\n", argv[0], out_file.c_str());
+      return 1;
+    }
+    WriteJson(file, argv[0], perf_counters.GetNames(), results);
+    fclose(file);
+  }
+  return 0;
+}
@@ -0,0 +1,24 @@
+// BenchmarkRunner.h : Minimal benchmark harness with Google Benchmark style output.
+//
+// Takes the same --benchmark_filter, --benchmark_min_time, --benchmark_out,
+// --benchmark_format and --benchmark_perf_counters flags and writes the same
+// JSON layout, so results can be fed to the usual comparison tools without
+// depending on the library. Perf counters are Linux only.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Returns the code to time, called repeatedly until the minimum time is
+// reached. Everything it needs is set up by the factory and not timed.
+typedef std::function<std::function<void()>()> BenchmarkFactory;
+
+// Registers a benchmark. bytes and items are the amount of data one call of
+// the timed code processes, used for the bytes_per_second and
+// items_per_second counters; 0 leaves the counter out.
+void RegisterBenchmark(const std::string& name, double bytes, double items, const BenchmarkFactory& factory);
+
+// Runs the registered benchmarks selected by the command line. Returns the
+// process exit code.
+int RunBenchmarks(int argc, char** argv);
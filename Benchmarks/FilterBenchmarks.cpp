@@ -0,0 +1,725 @@
+// FilterBenchmarks.cpp : Benchmarks of the HealDeadPixels and KelvinColorShift cores.
+//
+// Frames are synthetic and live in memory, laid out like AviSynth's, and are
+// processed the way the filters' GetFrame does it, so no AviSynth host is
+// needed. Run with --benchmark_format=json or --benchmark_out=<file> to get
+// results in Google Benchmark's JSON format.
+
+#include "BenchmarkRunner.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+#include "ColorShiftFrame.h"
+#include "ColorShiftKernels.h"
+#include "FrameCache.h"
+#include "FrameHash.h"
+#include "HealKernels.h"
+#include "HealRecipes.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Row alignment of the synthetic frames, AviSynth aligns at least this much.
+#define FRAME_ALIGN 64
+
+namespace {
+
+struct Resolution {
+  const char* name;
+  int width;
+  int height;
+};
+
+const Resolution RESOLUTIONS[] = {
+  { "720p", 1280, 720 },
+  { "1080p", 1920, 1080 },
+  { "4K", 3840, 2160 },
+};
+
+// Fraction of dead pixels in the benchmarked masks.
+struct MaskDensity {
+  const char* name;
+  double fraction;
+};
+
+const MaskDensity MASK_DENSITIES[] = {
+  { "0.001%", 0.00001 },
+  { "0.01%", 0.0001 },
+  { "0.1%", 0.001 },
+  { "1%", 0.01 },
+  { "5%", 0.05 },
+};
+
+// Absolute numbers of dead pixels, from a few stuck pixels to a sensor with a
+// damaged area. Benchmarked at 4K, where 1M is 12% of the pixels.
+struct MaskCount {
+  const char* name;
+  double count;
+};
+
+const MaskCount MASK_COUNTS[] = {
+  { "100", 100 },
+  { "10k", 10000 },
+  { "1M", 1000000 },
+};
+
+// xorshift32, deterministic so that every run processes the same data
+class Random {
+  uint32_t state;
+
+public:
+  explicit Random(uint32_t seed) : state(seed ? seed : 1) {
+  }
+
+  uint32_t Next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  int Below(int n) {
+    return (int)(Next() % (uint32_t)n);
+  }
+};
+
+// One plane of a synthetic frame.
+struct Plane {
+  Plane(int row_size, int height)
+    : row_size(row_size), height(height),
+      pitch((row_size + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN),
+      data((size_t)pitch * height) {
+  }
+
+  // gradients with some noise, roughly like footage
+  void Fill(uint32_t seed) {
+    Random random(seed);
+    for (int y = 0; y < height; y++) {
+      unsigned char* row = &data[(size_t)y * pitch];
+      for (int x = 0; x < row_size; x++) {
+        row[x] = (unsigned char)((x + y) / 8 + random.Below(32));
+      }
+    }
+  }
+
+  int row_size;
+  int height;
+  int pitch;
+  std::vector<unsigned char> data;
+};
+
+enum FrameFormat {
+  FORMAT_RGB24,
+  FORMAT_RGB32,
+  FORMAT_YV12,
+};
+
+const char* FormatName(FrameFormat format) {
+  switch (format) {
+  case FORMAT_RGB24:
+    return "RGB24";
+  case FORMAT_RGB32:
+    return "RGB32";
+  default:
+    return "YV12";
+  }
+}
+
+int BytesPerPixel(FrameFormat format) {
+  return format == FORMAT_RGB24 ? 3 : (format == FORMAT_RGB32 ? 4 : 1);
+}
+
+// RGB frames have a single plane, YV12 ones Y, U and V.
+struct Frame {
+  Frame(FrameFormat format, int width, int height) {
+    if (format == FORMAT_YV12) {
+      planes.push_back(Plane(width, height));
+      planes.push_back(Plane(width / 2, height / 2));
+      planes.push_back(Plane(width / 2, height / 2));
+    } else {
+      planes.push_back(Plane(width * BytesPerPixel(format), height));
+    }
+    for (size_t i = 0; i < planes.size(); i++) {
+      planes[i].Fill((uint32_t)(i + 1));
+    }
+  }
+
+  std::vector<Plane> planes;
+};
+
+// Bytes of pixel data in a frame, without the row padding.
+double GetFrameBytes(FrameFormat format, int width, int height) {
+  double luma = (double)width * height * BytesPerPixel(format);
+  return format == FORMAT_YV12 ? luma * 3 / 2 : luma;
+}
+
+std::string ThreadsSuffix(int threads) {
+  return "/threads:" + std::to_string(threads);
+}
+
+// 1, 2, 4, ... up to and including the hardware thread count
+std::vector<int> ThreadCounts() {
+  int hardware = ThreadPool(0).GetThreadCount();
+  std::vector<int> counts;
+  for (int n = 1; n < hardware; n *= 2) {
+    counts.push_back(n);
+  }
+  counts.push_back(hardware);
+  return counts;
+}
+
+//
+// KelvinColorShift
+//
+
+enum MaskMode {
+  MASK_NONE,
+  MASK_HARD,
+  MASK_SOFT,
+};
+
+struct ShiftOptions {
+  FrameFormat format;
+  Resolution resolution;
+  ShiftRowFunc shift_row;
+  int threads;
+  bool roi; // shift the center quarter of the picture only
+  MaskMode mask;
+};
+
+ShiftFramePlanes GetShiftFramePlanes(const Frame& src, Frame& dst) {
+  ShiftFramePlanes planes = {};
+  for (size_t p = 0; p < src.planes.size(); p++) {
+    planes.src[p] = &src.planes[p].data[0];
+    planes.src_pitch[p] = src.planes[p].pitch;
+    planes.dst[p] = &dst.planes[p].data[0];
+    planes.dst_pitch[p] = dst.planes[p].pitch;
+    planes.row_size[p] = src.planes[p].row_size;
+    planes.height[p] = src.planes[p].height;
+  }
+  return planes;
+}
+
+ShiftFrameOptions GetShiftFrameOptions(const ShiftOptions& options) {
+  long cpu_flags = GetCpuFlags();
+  int width = options.resolution.width;
+  int height = options.resolution.height;
+  ShiftFrameOptions shift_options;
+  shift_options.width = width;
+  shift_options.height = height;
+  shift_options.bytes_per_pixel = options.format == FORMAT_YV12 ? 0 : BytesPerPixel(options.format);
+  shift_options.stacked = false;
+  // mod 2 for YV12
+  shift_options.roi_x = options.roi ? width / 4 & ~1 : 0;
+  shift_options.roi_y = options.roi ? height / 4 & ~1 : 0;
+  shift_options.roi_width = options.roi ? width / 2 & ~1 : width;
+  shift_options.roi_height = options.roi ? height / 2 & ~1 : height;
+  shift_options.soft_mask = (options.mask == MASK_SOFT);
+  shift_options.shift_row = options.shift_row;
+  shift_options.shift_stacked_row = GetShiftStackedRowFunc(cpu_flags);
+  shift_options.blend_row = GetBlendRowFunc(cpu_flags);
+  return shift_options;
+}
+
+// A luma mask keeping the left third of the picture, shifting the right one
+// and fading between them, like a feathered selection.
+std::shared_ptr<Plane> BuildShiftMask(const Resolution& resolution) {
+  std::shared_ptr<Plane> mask = std::make_shared<Plane>(resolution.width, resolution.height);
+  int third = resolution.width / 3;
+  for (int y = 0; y < mask->height; y++) {
+    unsigned char* row = &mask->data[(size_t)y * mask->pitch];
+    for (int x = 0; x < mask->row_size; x++) {
+      int value = (x - third) * 255 / third;
+      row[x] = (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+  }
+  return mask;
+}
+
+// What KelvinColorShift::GetFrame does with a frame it can't write to.
+void RegisterShiftBenchmark(const std::string& name, const ShiftOptions& options) {
+  const Resolution& resolution = options.resolution;
+  double bytes = GetFrameBytes(options.format, resolution.width, resolution.height);
+  RegisterBenchmark(name, bytes, (double)resolution.width * resolution.height, [=]() {
+    std::shared_ptr<Frame> src = std::make_shared<Frame>(options.format, resolution.width, resolution.height);
+    std::shared_ptr<Frame> dst = std::make_shared<Frame>(options.format, resolution.width, resolution.height);
+    std::shared_ptr<ColorShiftTables> tables = std::make_shared<ColorShiftTables>(ComputeColorShift(3200, 5500));
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads);
+    std::shared_ptr<Plane> mask_plane;
+    ShiftMask mask = {};
+    if (options.mask != MASK_NONE) {
+      mask_plane = BuildShiftMask(resolution);
+      mask.ptr = &mask_plane->data[0];
+      mask.pitch = mask_plane->pitch;
+      mask.bytes_per_pixel = 1;
+      mask.height = mask_plane->height;
+      mask.bottom_up = false;
+    }
+    ShiftFrameOptions shift_options = GetShiftFrameOptions(options);
+    std::shared_ptr<ShiftFrameScratch> scratch = std::make_shared<ShiftFrameScratch>();
+    return [=]() {
+      ShiftFrame(GetShiftFramePlanes(*src, *dst), mask_plane ? &mask : NULL, *tables, shift_options, *scratch, *pool);
+    };
+  });
+}
+
+// The per-pixel RGB48 loop KelvinColorShift ran before it had lookup tables
+// and row kernels, the baseline the kernels are measured against. It worked
+// in place, so the alpha is copied here to leave the same frame behind.
+template<int bytes_per_pixel>
+void ShiftRowRGB48(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  RGB48 shift = tables.shift;
+  for (int x = 0; x < width * bytes_per_pixel; x += bytes_per_pixel) {
+    RGB48 rgb(&src[x]);
+    rgb *= shift;
+    rgb.ToRGB8(&dst[x]);
+    if (bytes_per_pixel == 4) {
+      dst[x + 3] = src[x + 3];
+    }
+  }
+}
+
+// Blends a shifted RGB32 frame with its source under a soft mask with a
+// gradient across it, the extra work of KelvinColorShift with soft_mask.
+void RegisterBlendBenchmark(const std::string& name, const Resolution& resolution, BlendRowFunc blend_row) {
+  double bytes = GetFrameBytes(FORMAT_RGB32, resolution.width, resolution.height);
+  RegisterBenchmark(name, bytes, (double)resolution.width * resolution.height, [=]() {
+    std::shared_ptr<Frame> src = std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height);
+    std::shared_ptr<Frame> shifted = std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height);
+    std::shared_ptr<Frame> dst = std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height);
+    std::shared_ptr<std::vector<unsigned char> > weights = std::make_shared<std::vector<unsigned char> >(
+      src->planes[0].row_size);
+    for (size_t i = 0; i < weights->size(); i++) {
+      (*weights)[i] = (unsigned char)(i / 4 * 255 / resolution.width);
+    }
+    return [=]() {
+      const Plane& s = src->planes[0];
+      const Plane& t = shifted->planes[0];
+      Plane& d = dst->planes[0];
+      for (int y = 0; y < s.height; y++) {
+        blend_row(&s.data[(size_t)y * s.pitch], &t.data[(size_t)y * t.pitch], &d.data[(size_t)y * d.pitch],
+          &(*weights)[0], s.row_size);
+      }
+    };
+  });
+}
+
+// Hashes every row of an RGB32 frame, the extra work per frame of
+// KelvinColorShift with a cache.
+void RegisterHashBenchmark(const std::string& name, const Resolution& resolution, HashStripesFunc hash_stripes) {
+  double bytes = GetFrameBytes(FORMAT_RGB32, resolution.width, resolution.height);
+  RegisterBenchmark(name, bytes, (double)resolution.width * resolution.height, [=]() {
+    std::shared_ptr<Frame> src = std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height);
+    return [=]() {
+      const Plane& s = src->planes[0];
+      FrameHash hash(hash_stripes);
+      hash.AddPlane(&s.data[0], s.pitch, s.row_size, s.height);
+      volatile uint64_t result = hash.Finish();
+      (void)result;
+    };
+  });
+}
+
+// Number of frames in the clip of the cache benchmarks, and how often each
+// source frame is repeated in a row, like animation on fours or a still.
+#define CACHE_CLIP_FRAMES 24
+#define CACHE_CLIP_REPEATS 4
+
+// Shifts a clip in which every frame repeats the previous one a few times,
+// through a frame cache like KelvinColorShift with cache_mb or without one.
+// Each run starts with an empty cache, so the first of each repeated frames
+// is shifted and the others are hits.
+void RegisterCacheBenchmark(const std::string& name, const Resolution& resolution, bool use_cache, int threads) {
+  double bytes = GetFrameBytes(FORMAT_RGB32, resolution.width, resolution.height) * CACHE_CLIP_FRAMES;
+  RegisterBenchmark(name, bytes, CACHE_CLIP_FRAMES, [=]() {
+    std::vector<std::shared_ptr<Frame> > sources;
+    std::vector<std::shared_ptr<Frame> > shifted;
+    for (int i = 0; i < CACHE_CLIP_FRAMES / CACHE_CLIP_REPEATS; i++) {
+      std::shared_ptr<Frame> source = std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height);
+      source->planes[0].Fill((uint32_t)(i + 1));
+      sources.push_back(source);
+    }
+    for (int i = 0; i < CACHE_CLIP_FRAMES; i++) {
+      shifted.push_back(std::make_shared<Frame>(FORMAT_RGB32, resolution.width, resolution.height));
+    }
+    std::shared_ptr<ColorShiftTables> tables = std::make_shared<ColorShiftTables>(ComputeColorShift(3200, 5500));
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(threads);
+    long cpu_flags = GetCpuFlags();
+    HashStripesFunc hash_stripes = GetHashStripesFunc(cpu_flags);
+    ShiftOptions options = { FORMAT_RGB32, resolution, GetShiftRowFunc(4, cpu_flags), threads, false, MASK_NONE };
+    ShiftFrameOptions shift_options = GetShiftFrameOptions(options);
+    std::shared_ptr<ShiftFrameScratch> scratch = std::make_shared<ShiftFrameScratch>();
+    return [=]() {
+      FrameCache<std::shared_ptr<Frame> > cache((size_t)256 << 20);
+      for (int n = 0; n < CACHE_CLIP_FRAMES; n++) {
+        const Frame& src = *sources[n / CACHE_CLIP_REPEATS];
+        FrameCacheKey key = {};
+        if (use_cache) {
+          const Plane& s = src.planes[0];
+          std::vector<uint64_t> band_hashes;
+          HashPlaneBands(&s.data[0], s.pitch, s.row_size, s.height, hash_stripes, *pool, band_hashes);
+          key.hash = HashBandHashes(band_hashes, hash_stripes);
+          key.temp = 5500;
+          std::shared_ptr<Frame> cached;
+          if (cache.Lookup(key, cached)) {
+            continue;
+          }
+        }
+        ShiftFrame(GetShiftFramePlanes(src, *shifted[n]), NULL, *tables, shift_options, *scratch, *pool);
+        if (use_cache) {
+          cache.Insert(key, shifted[n], shifted[n]->planes[0].data.size());
+        }
+      }
+    };
+  });
+}
+
+void RegisterShiftBenchmarks() {
+  const FrameFormat formats[] = { FORMAT_RGB24, FORMAT_RGB32, FORMAT_YV12 };
+  long cpu_flags = GetCpuFlags();
+
+  ShiftOptions options;
+  options.threads = 1;
+  options.roi = false;
+  options.mask = MASK_NONE;
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    options.format = formats[f];
+    options.shift_row = GetShiftRowFunc(BytesPerPixel(formats[f]), cpu_flags);
+    for (size_t r = 0; r < sizeof(RESOLUTIONS) / sizeof(RESOLUTIONS[0]); r++) {
+      options.resolution = RESOLUTIONS[r];
+      std::string name = std::string("KelvinColorShift/") + FormatName(formats[f]) + "/" + RESOLUTIONS[r].name;
+      RegisterShiftBenchmark(name, options);
+    }
+  }
+
+  // a region of interest, and a mask keeping a third of the picture and
+  // fading over another third, hard and soft
+  const Resolution& hd = RESOLUTIONS[1];
+  options.resolution = hd;
+  const FrameFormat masked_formats[] = { FORMAT_RGB32, FORMAT_YV12 };
+  for (size_t f = 0; f < sizeof(masked_formats) / sizeof(masked_formats[0]); f++) {
+    options.format = masked_formats[f];
+    options.shift_row = GetShiftRowFunc(BytesPerPixel(masked_formats[f]), cpu_flags);
+    std::string prefix = std::string("KelvinColorShift/") + FormatName(masked_formats[f]) + "/" + hd.name;
+    options.roi = true;
+    RegisterShiftBenchmark(prefix + "/roi:center", options);
+    options.roi = false;
+    options.mask = MASK_HARD;
+    RegisterShiftBenchmark(prefix + "/mask:hard", options);
+    options.mask = MASK_SOFT;
+    RegisterShiftBenchmark(prefix + "/mask:soft", options);
+    options.mask = MASK_NONE;
+  }
+
+  // each row kernel on its own, and the original per-pixel loop
+  struct {
+    const char* name;
+    FrameFormat format;
+    ShiftRowFunc shift_row;
+    bool (*supported)();
+  } kernels[] = {
+    { "RGB48", FORMAT_RGB24, ShiftRowRGB48<3>, NULL },
+    { "C", FORMAT_RGB24, ShiftRowRGB24_C, NULL },
+    { "SSE2", FORMAT_RGB24, ShiftRowRGB24_SSE2, NULL },
+    { "SSSE3", FORMAT_RGB24, ShiftRowRGB24_SSSE3, IsSSSE3Supported },
+    { "AVX2", FORMAT_RGB24, ShiftRowRGB24_AVX2, IsAVX2Supported },
+    { "RGB48", FORMAT_RGB32, ShiftRowRGB48<4>, NULL },
+    { "C", FORMAT_RGB32, ShiftRowRGB32_C, NULL },
+    { "SSE2", FORMAT_RGB32, ShiftRowRGB32_SSE2, NULL },
+    { "AVX2", FORMAT_RGB32, ShiftRowRGB32_AVX2, IsAVX2Supported },
+  };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    if (kernels[k].supported && !kernels[k].supported()) {
+      continue;
+    }
+    std::string name = std::string("KelvinColorShift/") + FormatName(kernels[k].format) + "/" + hd.name +
+      "/kernel:" + kernels[k].name;
+    options.format = kernels[k].format;
+    options.shift_row = kernels[k].shift_row;
+    RegisterShiftBenchmark(name, options);
+  }
+
+  // each soft mask blend kernel
+  struct {
+    const char* name;
+    BlendRowFunc blend_row;
+    bool avx2;
+  } blend_kernels[] = {
+    { "C", BlendRow_C, false },
+    { "SSE2", BlendRow_SSE2, false },
+    { "AVX2", BlendRow_AVX2, true },
+  };
+  for (size_t k = 0; k < sizeof(blend_kernels) / sizeof(blend_kernels[0]); k++) {
+    if (blend_kernels[k].avx2 && !IsAVX2Supported()) {
+      continue;
+    }
+    std::string name = std::string("KelvinColorShift/Blend/RGB32/") + hd.name + "/kernel:" + blend_kernels[k].name;
+    RegisterBlendBenchmark(name, hd, blend_kernels[k].blend_row);
+  }
+
+  // each content hash kernel
+  struct {
+    const char* name;
+    HashStripesFunc hash_stripes;
+    bool avx2;
+  } hash_kernels[] = {
+    { "C", HashStripes_C, false },
+    { "SSE2", HashStripes_SSE2, false },
+    { "AVX2", HashStripes_AVX2, true },
+  };
+  for (size_t k = 0; k < sizeof(hash_kernels) / sizeof(hash_kernels[0]); k++) {
+    if (hash_kernels[k].avx2 && !IsAVX2Supported()) {
+      continue;
+    }
+    std::string name = std::string("KelvinColorShift/Hash/RGB32/") + hd.name + "/kernel:" + hash_kernels[k].name;
+    RegisterHashBenchmark(name, hd, hash_kernels[k].hash_stripes);
+  }
+
+  // a clip of repeated frames with and without the frame cache
+  for (int use_cache = 0; use_cache < 2; use_cache++) {
+    std::string name = std::string("KelvinColorShift/RepeatedFrames/RGB32/") + hd.name +
+      (use_cache ? "/cache:on" : "/cache:off");
+    RegisterCacheBenchmark(name, hd, use_cache != 0, 1);
+  }
+
+  // scaling with the thread count
+  const Resolution& uhd = RESOLUTIONS[2];
+  std::vector<int> thread_counts = ThreadCounts();
+  for (size_t t = 0; t < thread_counts.size(); t++) {
+    std::string name = std::string("KelvinColorShift/RGB32/") + uhd.name + ThreadsSuffix(thread_counts[t]);
+    options.format = FORMAT_RGB32;
+    options.resolution = uhd;
+    options.shift_row = GetShiftRowFunc(4, cpu_flags);
+    options.threads = thread_counts[t];
+    RegisterShiftBenchmark(name, options);
+  }
+}
+
+//
+// HealDeadPixels
+//
+
+// Marks about fraction of the pixels dead, either scattered uniformly or in
+// clusters of up to 16 pixels like damaged sensor areas.
+std::shared_ptr<DeadPixelMask> BuildMask(int width, int height, double fraction, bool clustered) {
+  std::shared_ptr<DeadPixelMask> mask = std::make_shared<DeadPixelMask>(width, height);
+  std::vector<bool> dead((size_t)width * height);
+  size_t target = (size_t)(fraction * width * height + 0.5);
+  if (target < 1) {
+    target = 1;
+  }
+
+  Random random(12345);
+  size_t count = 0;
+  while (count < target) {
+    int x = random.Below(width);
+    int y = random.Below(height);
+    int cluster_size = clustered ? 1 + random.Below(16) : 1;
+    for (int i = 0; i < cluster_size && count < target; i++) {
+      if (!dead[(size_t)y * width + x]) {
+        dead[(size_t)y * width + x] = true;
+        mask->SetDead(x, y);
+        count++;
+      }
+      // random walk to a neighbor
+      x += random.Below(3) - 1;
+      y += random.Below(3) - 1;
+      x = x < 0 ? 0 : (x >= width ? width - 1 : x);
+      y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+    }
+  }
+  return mask;
+}
+
+double CountDeadPixels(const Resolution& resolution, double fraction) {
+  double count = fraction * resolution.width * resolution.height;
+  return count < 1 ? 1 : count;
+}
+
+double GetDeadPixelFraction(const Resolution& resolution, double count) {
+  return count / ((double)resolution.width * resolution.height);
+}
+
+void RegisterGenerateBenchmark(const std::string& name, const Resolution& resolution, double fraction, bool clustered) {
+  RegisterBenchmark(name, 0, CountDeadPixels(resolution, fraction), [=]() {
+    std::shared_ptr<DeadPixelMask> mask = BuildMask(resolution.width, resolution.height, fraction, clustered);
+    return [=]() {
+      PixelHealRecipes recipes;
+      GeneratePixelHealRecipes(*mask, recipes);
+    };
+  });
+}
+
+void RegisterGenerateBenchmarks() {
+  const Resolution& hd = RESOLUTIONS[1];
+  for (int clustered = 0; clustered < 2; clustered++) {
+    for (size_t d = 0; d < sizeof(MASK_DENSITIES) / sizeof(MASK_DENSITIES[0]); d++) {
+      std::string name = std::string("HealDeadPixels/GenerateRecipes/") + hd.name + "/" +
+        (clustered ? "clustered" : "uniform") + "/" + MASK_DENSITIES[d].name;
+      double fraction = MASK_DENSITIES[d].fraction;
+      RegisterGenerateBenchmark(name, hd, fraction, clustered != 0);
+    }
+  }
+
+  const Resolution& uhd = RESOLUTIONS[2];
+  for (int clustered = 0; clustered < 2; clustered++) {
+    for (size_t c = 0; c < sizeof(MASK_COUNTS) / sizeof(MASK_COUNTS[0]); c++) {
+      std::string name = std::string("HealDeadPixels/GenerateRecipes/") + uhd.name + "/" +
+        (clustered ? "clustered" : "uniform") + "/count:" + MASK_COUNTS[c].name;
+      RegisterGenerateBenchmark(name, uhd, GetDeadPixelFraction(uhd, MASK_COUNTS[c].count), clustered != 0);
+    }
+  }
+}
+
+// The recipes of one plane compiled for its layout.
+struct HealPlaneSetup {
+  PixelHealRecipes recipes;
+  CompiledPixelHealRecipes compiled;
+};
+
+struct HealOptions {
+  FrameFormat format;
+  Resolution resolution;
+  double fraction;
+  bool clustered;
+  bool row_order; // heal row by row instead of tile by tile
+  long cpu_flags;
+  int threads;
+};
+
+// What HealDeadPixels::GetFrame does with every frame.
+void RegisterHealBenchmark(const std::string& name, const HealOptions& options) {
+  RegisterBenchmark(name, 0, CountDeadPixels(options.resolution, options.fraction), [=]() {
+    int width = options.resolution.width;
+    int height = options.resolution.height;
+    bool yv12 = (options.format == FORMAT_YV12);
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>(options.format, width, height);
+    std::shared_ptr<DeadPixelMask> mask = BuildMask(width, height, options.fraction, options.clustered);
+
+    std::shared_ptr<std::vector<HealPlaneSetup> > setups = std::make_shared<std::vector<HealPlaneSetup> >(yv12 ? 2 : 1);
+    GeneratePixelHealRecipes(*mask, (*setups)[0].recipes);
+    if (yv12) {
+      GenerateChromaHealRecipes((*setups)[0].recipes, width / 2, height / 2, (*setups)[1].recipes);
+    }
+    if (options.row_order) {
+      for (size_t i = 0; i < setups->size(); i++) {
+        PixelHealRecipes sorted;
+        std::vector<size_t> row_starts;
+        SortRecipesByRow((*setups)[i].recipes, height >> i, sorted, row_starts);
+        (*setups)[i].recipes = sorted;
+      }
+    }
+    for (size_t i = 0; i < setups->size(); i++) {
+      const Plane& plane = frame->planes[i];
+      PlaneLayout layout;
+      layout.width = width >> i;
+      layout.height = height >> i;
+      layout.pitch = plane.pitch;
+      layout.bytes_per_pixel = BytesPerPixel(options.format);
+      layout.bottom_up = !yv12;
+      (*setups)[i].compiled.Compile((*setups)[i].recipes, layout);
+    }
+
+    HealPixelsFunc heal_pixels = GetHealPixelsFunc(options.cpu_flags, BytesPerPixel(options.format));
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads);
+    return [=]() {
+      for (size_t p = 0; p < frame->planes.size(); p++) {
+        const HealPlaneSetup& setup = (*setups)[p == 0 ? 0 : 1];
+        HealPlaneTiles(&frame->planes[p].data[0], setup.recipes, setup.compiled, heal_pixels, *pool);
+      }
+    };
+  });
+}
+
+void RegisterHealBenchmarks() {
+  long cpu_flags = GetCpuFlags();
+  const Resolution& hd = RESOLUTIONS[1];
+  const Resolution& uhd = RESOLUTIONS[2];
+
+  HealOptions options;
+  options.format = FORMAT_RGB32;
+  options.resolution = hd;
+  options.row_order = false;
+  options.cpu_flags = cpu_flags;
+  options.threads = 1;
+
+  for (int clustered = 0; clustered < 2; clustered++) {
+    for (size_t d = 0; d < sizeof(MASK_DENSITIES) / sizeof(MASK_DENSITIES[0]); d++) {
+      options.fraction = MASK_DENSITIES[d].fraction;
+      options.clustered = (clustered != 0);
+      std::string name = std::string("HealDeadPixels/GetFrame/RGB32/") + hd.name + "/" +
+        (clustered ? "clustered" : "uniform") + "/" + MASK_DENSITIES[d].name;
+      RegisterHealBenchmark(name, options);
+    }
+  }
+
+  // a few to a million dead pixels
+  options.resolution = uhd;
+  for (int clustered = 0; clustered < 2; clustered++) {
+    for (size_t c = 0; c < sizeof(MASK_COUNTS) / sizeof(MASK_COUNTS[0]); c++) {
+      options.fraction = GetDeadPixelFraction(uhd, MASK_COUNTS[c].count);
+      options.clustered = (clustered != 0);
+      std::string name = std::string("HealDeadPixels/GetFrame/RGB32/") + uhd.name + "/" +
+        (clustered ? "clustered" : "uniform") + "/count:" + MASK_COUNTS[c].name;
+      RegisterHealBenchmark(name, options);
+    }
+  }
+  options.resolution = hd;
+
+  // other formats and the kernels on their own, at 1% uniform
+  options.fraction = 0.01;
+  options.clustered = false;
+  const FrameFormat formats[] = { FORMAT_RGB24, FORMAT_RGB32, FORMAT_YV12 };
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    options.format = formats[f];
+    std::string prefix = std::string("HealDeadPixels/GetFrame/") + FormatName(formats[f]) + "/" + hd.name + "/uniform/1%";
+    if (formats[f] != FORMAT_RGB32) {
+      RegisterHealBenchmark(prefix, options);
+    }
+    options.cpu_flags = 0;
+    RegisterHealBenchmark(prefix + "/kernel:C", options);
+    if (IsAVX2Supported()) {
+      options.cpu_flags = CPU_FLAG_SSE2;
+      RegisterHealBenchmark(prefix + "/kernel:AVX2", options);
+    }
+    options.cpu_flags = cpu_flags;
+  }
+
+  // tile order against plain row order, where the rows around a dead pixel
+  // may fall out of the cache before the next one in its neighborhood is
+  // healed; --benchmark_perf_counters=CACHE-MISSES,L1D-LOAD-MISSES counts the
+  // misses of both
+  options.format = FORMAT_RGB32;
+  options.resolution = uhd;
+  for (int row_order = 0; row_order < 2; row_order++) {
+    for (size_t d = 3; d < sizeof(MASK_DENSITIES) / sizeof(MASK_DENSITIES[0]); d++) {
+      options.fraction = MASK_DENSITIES[d].fraction;
+      options.row_order = (row_order != 0);
+      std::string name = std::string("HealDeadPixels/GetFrame/RGB32/") + uhd.name + "/uniform/" +
+        MASK_DENSITIES[d].name + (row_order ? "/order:row" : "/order:tile");
+      RegisterHealBenchmark(name, options);
+    }
+  }
+  options.row_order = false;
+
+  // scaling with the thread count
+  options.fraction = 0.01;
+  std::vector<int> thread_counts = ThreadCounts();
+  for (size_t t = 0; t < thread_counts.size(); t++) {
+    options.threads = thread_counts[t];
+    std::string name = std::string("HealDeadPixels/GetFrame/RGB32/") + uhd.name + "/uniform/1%" +
+      ThreadsSuffix(thread_counts[t]);
+    RegisterHealBenchmark(name, options);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  RegisterShiftBenchmarks();
+  RegisterGenerateBenchmarks();
+  RegisterHealBenchmarks();
+  return RunBenchmarks(argc, argv);
+}
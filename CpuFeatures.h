@@ -0,0 +1,68 @@
+// CpuFeatures.h : CPU feature detection beyond AviSynth's CPUF_* flags.
+//
+
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+
+// Value of AviSynth's CPUF_SSE2. The kernel dispatchers take the flags returned
+// by IScriptEnvironment::GetCPUFlags() but must not depend on avisynth.h.
+#define CPU_FLAG_SSE2 0x20
+
+inline void CpuId(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+  __cpuidex(info, leaf, subleaf);
+#else
+  __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+inline unsigned long long ReadXCR0() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+// AviSynth 2.5 has no CPUF_SSSE3 flag.
+inline bool IsSSSE3Supported() {
+  int info[4];
+  CpuId(info, 1, 0);
+  return (info[2] & (1 << 9)) != 0;
+}
+
+// AviSynth's CPUF_* flags predate AVX2, so we query the CPU and OS ourselves.
+inline bool IsAVX2Supported() {
+  int info[4];
+  CpuId(info, 0, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+
+  // the OS has to preserve the YMM registers across context switches
+  CpuId(info, 1, 0);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (ReadXCR0() & 6) != 6) {
+    return false;
+  }
+
+  CpuId(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+
+// The CPUF_* flags the kernel dispatchers look at, for callers without an
+// IScriptEnvironment.
+inline long GetCpuFlags() {
+  int info[4];
+  CpuId(info, 1, 0);
+  return (info[3] & (1 << 26)) ? CPU_FLAG_SSE2 : 0;
+}
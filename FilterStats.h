@@ -0,0 +1,194 @@
+// FilterStats.h : Opt-in per-instance timing and counters.
+//
+// A filter given a stats file creates one FilterStats and records every
+// GetFrame with a FrameTimer. Threads add to one of several counter shards
+// picked by their id, the shards are only merged when the totals are read, so
+// concurrent GetFrame calls don't fight over one cache line. Without a stats
+// file the filter holds no FilterStats and FrameTimer does nothing.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Number of counter shards.
+#define FILTER_STATS_SHARDS 16
+
+// Bucket i of the frame time histogram counts frames that took [2^i, 2^(i+1))
+// nanoseconds, bucket 0 also those that took 0.
+#define FRAME_TIME_BUCKETS 40
+
+class FilterStats {
+  struct Shard {
+    Shard() {
+      frames = 0;
+      frames_copied = 0;
+      total_ns = 0;
+      for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+        frame_ns_histogram[i] = 0;
+      }
+    }
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> frames_copied;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> frame_ns_histogram[FRAME_TIME_BUCKETS];
+
+    // keeps the next shard off this one's last cache line
+    char padding[64];
+  };
+
+  std::string filter_name;
+  std::vector<Shard> shards;
+  std::atomic<uint64_t> recipes;
+  std::atomic<uint64_t> recipe_ns;
+
+  Shard& GetShard() {
+    size_t hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return shards[hash % FILTER_STATS_SHARDS];
+  }
+
+  static int GetBucket(uint64_t ns) {
+    int bucket = 0;
+    while (ns > 1 && bucket < FRAME_TIME_BUCKETS - 1) {
+      ns >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+public:
+  struct Totals {
+    uint64_t frames;
+    uint64_t frames_copied; // frames that could not be processed in place
+    uint64_t total_ns;
+    uint64_t frame_ns_histogram[FRAME_TIME_BUCKETS];
+    uint64_t recipes;
+    uint64_t recipe_ns;
+  };
+
+  explicit FilterStats(const char* filter_name)
+    : filter_name(filter_name), shards(FILTER_STATS_SHARDS) {
+    recipes = 0;
+    recipe_ns = 0;
+  }
+
+  // Monotonic time in nanoseconds. steady_clock only ticks in milliseconds
+  // with older MSVC runtimes, so Windows asks the performance counter.
+  static uint64_t Now() {
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  void AddFrame(uint64_t ns, bool copied) {
+    Shard& shard = GetShard();
+    shard.frames.fetch_add(1, std::memory_order_relaxed);
+    if (copied) {
+      shard.frames_copied.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    shard.frame_ns_histogram[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Records the number of recipes a filter heals every frame with, counting
+  // each plane, and the time it took to look up, load or generate them.
+  // Called once, from the constructor.
+  void AddRecipes(uint64_t count, uint64_t ns) {
+    recipes.fetch_add(count, std::memory_order_relaxed);
+    recipe_ns.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  Totals Read() const {
+    Totals totals = {};
+    for (size_t s = 0; s < shards.size(); s++) {
+      totals.frames += shards[s].frames.load(std::memory_order_relaxed);
+      totals.frames_copied += shards[s].frames_copied.load(std::memory_order_relaxed);
+      totals.total_ns += shards[s].total_ns.load(std::memory_order_relaxed);
+      for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+        totals.frame_ns_histogram[i] += shards[s].frame_ns_histogram[i].load(std::memory_order_relaxed);
+      }
+    }
+    totals.recipes = recipes.load(std::memory_order_relaxed);
+    totals.recipe_ns = recipe_ns.load(std::memory_order_relaxed);
+    return totals;
+  }
+
+  // Appends the totals to file as one line of JSON. The histogram lists the
+  // upper bound in ns and the count of every non-empty bucket.
+  bool Dump(const char* file_name) const {
+    FILE* file = NULL;
+#ifdef _MSC_VER
+    if (fopen_s(&file, file_name, "a") != 0) {
+      return false;
+    }
+#else
+    file = fopen(file_name, "a");
+    if (file == NULL) {
+      return false;
+    }
+#endif
+
+    Totals totals = Read();
+    fprintf(file, "{\"filter\": \"%s\", \"frames\": %llu, \"frames_copied\": %llu, \"total_ns\": %llu, "
+      "\"recipes\": %llu, \"recipe_ns\": %llu, \"frame_ns_histogram\": [",
+      filter_name.c_str(),
+      (unsigned long long)totals.frames,
+      (unsigned long long)totals.frames_copied,
+      (unsigned long long)totals.total_ns,
+      (unsigned long long)totals.recipes,
+      (unsigned long long)totals.recipe_ns);
+    bool first = true;
+    for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+      if (totals.frame_ns_histogram[i] != 0) {
+        fprintf(file, "%s[%llu, %llu]", first ? "" : ", ",
+          (unsigned long long)2 << i, (unsigned long long)totals.frame_ns_histogram[i]);
+        first = false;
+      }
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+  }
+};
+
+// Records the duration of one GetFrame call when the filter keeps stats.
+class FrameTimer {
+  FilterStats* stats;
+  uint64_t start;
+  bool copied;
+
+public:
+  explicit FrameTimer(FilterStats* stats)
+    : stats(stats), start(stats ? FilterStats::Now() : 0), copied(false) {
+  }
+
+  ~FrameTimer() {
+    if (stats) {
+      stats->AddFrame(FilterStats::Now() - start, copied);
+    }
+  }
+
+  // The frame was copied or written to a new frame instead of in place.
+  void SetCopied() {
+    copied = true;
+  }
+};
@@ -0,0 +1,101 @@
+// DeadPixelStats.cpp : Per-pixel statistics DetectDeadPixels decides by.
+//
+
+#include "DeadPixelStats.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+DeadPixelStats::DeadPixelStats(int width, int height)
+  : width(width), height(height),
+    stuck_counts((size_t)width * height), outlier_counts((size_t)width * height) {
+}
+
+// Largest difference of the first channels bytes of two pixels.
+static inline int PixelDistance(const unsigned char* a, const unsigned char* b, int channels) {
+  int d = 0;
+  for (int c = 0; c < channels; c++) {
+    int dc = abs((int)a[c] - b[c]);
+    d = dc > d ? dc : d;
+  }
+  return d;
+}
+
+void DeadPixelStats::AddFrame(
+  const unsigned char* frame,
+  int pitch,
+  const unsigned char* previous,
+  int previous_pitch,
+  int bytes_per_pixel,
+  int threshold,
+  int y_begin,
+  int y_end
+  ) {
+  int channels = bytes_per_pixel < 3 ? bytes_per_pixel : 3;
+  for (int y = y_begin; y < y_end; y++) {
+    // neighbors outside of the frame are mirrored
+    int up = y + 1 < height ? y + 1 : y - 1;
+    int down = y > 0 ? y - 1 : y + 1;
+    const unsigned char* rows[3] = {
+      frame + (size_t)y * pitch,
+      frame + (size_t)up * pitch,
+      frame + (size_t)down * pitch
+    };
+    const unsigned char* previous_rows[3] = { NULL, NULL, NULL };
+    if (previous != NULL) {
+      previous_rows[0] = previous + (size_t)y * previous_pitch;
+      previous_rows[1] = previous + (size_t)up * previous_pitch;
+      previous_rows[2] = previous + (size_t)down * previous_pitch;
+    }
+    size_t index = (size_t)y * width;
+
+    for (int x = 0; x < width; x++, index++) {
+      int left = (x > 0 ? x - 1 : x + 1) * bytes_per_pixel;
+      int right = (x + 1 < width ? x + 1 : x - 1) * bytes_per_pixel;
+      int center = x * bytes_per_pixel;
+      // row and byte offset within it of each neighbor
+      const int neighbors[4][2] = {
+        { 0, left },
+        { 0, right },
+        { 1, center },
+        { 2, center }
+      };
+
+      const unsigned char* pixel = rows[0] + center;
+      int outlier_distance = 0;
+      for (int c = 0; c < channels; c++) {
+        int sum = 2;
+        for (int i = 0; i < 4; i++) {
+          sum += rows[neighbors[i][0]][neighbors[i][1] + c];
+        }
+        int d = abs((int)pixel[c] - sum / 4);
+        if (d > outlier_distance) {
+          outlier_distance = d;
+        }
+      }
+      if (outlier_distance > threshold) {
+        outlier_counts[index]++;
+      }
+
+      if (previous != NULL && PixelDistance(pixel, previous_rows[0] + center, channels) == 0) {
+        for (int i = 0; i < 4; i++) {
+          int row = neighbors[i][0];
+          int offset = neighbors[i][1];
+          if (PixelDistance(rows[row] + offset, previous_rows[row] + offset, channels) != 0) {
+            stuck_counts[index]++;
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+bool DeadPixelStats::IsDead(size_t index, int frame_count) const {
+  int outlier_limit = frame_count * DEAD_PIXEL_MIN_PERCENT / 100;
+  int stuck_limit = (frame_count - 1) * DEAD_PIXEL_MIN_PERCENT / 100;
+  if (outlier_limit < 1) {
+    outlier_limit = 1;
+  }
+  return outlier_counts[index] >= outlier_limit || (stuck_limit > 0 && stuck_counts[index] >= stuck_limit);
+}
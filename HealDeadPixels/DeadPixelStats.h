@@ -0,0 +1,48 @@
+// DeadPixelStats.h : Per-pixel statistics DetectDeadPixels decides by.
+//
+// Free of AviSynth and Windows dependencies, see CMakeLists.txt.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Percentage of the analyzed frames in which a pixel must look stuck or stand
+// out from its neighbors to be considered dead.
+#define DEAD_PIXEL_MIN_PERCENT 90
+
+// Per-pixel counters accumulated over the analyzed frames.
+struct DeadPixelStats {
+  DeadPixelStats(int width, int height);
+
+  // Updates the counters of rows [y_begin, y_end). previous is the previously
+  // analyzed frame or NULL, which need not have the pitch of frame. Pixels of
+  // 3 or 4 bytes are compared by their BGR channels, those of 1 byte (the
+  // luma plane of a planar clip) by that byte.
+  void AddFrame(
+    const unsigned char* frame,
+    int pitch,
+    const unsigned char* previous,
+    int previous_pitch,
+    int bytes_per_pixel,
+    int threshold,
+    int y_begin,
+    int y_end
+  );
+
+  // Whether the pixel at index looked stuck or stood out in at least
+  // DEAD_PIXEL_MIN_PERCENT of frame_count analyzed frames. A pixel can only
+  // look stuck from the second frame on.
+  bool IsDead(size_t index, int frame_count) const;
+
+  int width;
+  int height;
+
+  // frames in which the pixel kept its value while a neighbor changed
+  std::vector<uint16_t> stuck_counts;
+
+  // frames in which the pixel differed from its neighbors' average by more
+  // than the threshold
+  std::vector<uint16_t> outlier_counts;
+};
@@ -0,0 +1,119 @@
+// DetectDeadPixels.cpp : Builds a HealDeadPixels mask by analyzing footage.
+//
+
+#include "stdafx.h"
+#include "DetectDeadPixels.h"
+
+#include <cstdio>
+
+// Number of row bands per thread each frame is split into.
+#define DETECT_BANDS_PER_THREAD 4
+
+DetectDeadPixels::DetectDeadPixels(
+  PClip _child,
+  const char* mask_file,
+  int frames,
+  int threshold,
+  int threads,
+  IScriptEnvironment* env
+  ) : GenericVideoFilter(_child) {
+  if (!vi.IsRGB() && !vi.IsYV12()) {
+    env->ThrowError("DetectDeadPixels: Unsupported color format. RGB or YV12 data only!");
+  }
+  if (vi.width < 2 || vi.height < 2) {
+    env->ThrowError("DetectDeadPixels: Clip is too small!");
+  }
+  if (*mask_file == 0) {
+    env->ThrowError("DetectDeadPixels: No mask file given!");
+  }
+  if (frames < 1 || frames > UINT16_MAX) {
+    env->ThrowError("DetectDeadPixels: Frame count must be between 1 and 65535!");
+  }
+  if (threshold < 0) {
+    env->ThrowError("DetectDeadPixels: Threshold must not be negative!");
+  }
+  if (threads < 0) {
+    env->ThrowError("DetectDeadPixels: Thread count must not be negative!");
+  }
+  if (frames > vi.num_frames) {
+    frames = vi.num_frames;
+  }
+
+  // the luma plane of YV12, one byte per pixel
+  int bytes_per_pixel = vi.IsRGB() ? vi.BytesFromPixels(1) : 1;
+  DeadPixelStats stats(vi.width, vi.height);
+  ThreadPool pool(threads);
+  int band_count = pool.GetThreadCount() * DETECT_BANDS_PER_THREAD;
+  if (band_count > vi.height) {
+    band_count = vi.height;
+  }
+
+  // sample frames evenly over the whole clip, keeping only the previous one
+  PVideoFrame previous;
+  for (int i = 0; i < frames; i++) {
+    PVideoFrame frame = child->GetFrame((int)((int64_t)i * vi.num_frames / frames), env);
+    // PLANAR_Y is the only plane of an RGB frame
+    const unsigned char* frame_ptr = frame->GetReadPtr(PLANAR_Y);
+    const unsigned char* previous_ptr = previous ? previous->GetReadPtr(PLANAR_Y) : NULL;
+    int pitch = frame->GetPitch(PLANAR_Y);
+    int previous_pitch = previous ? previous->GetPitch(PLANAR_Y) : 0;
+    int height = vi.height;
+
+    pool.ParallelFor(band_count, [&](int band) {
+      stats.AddFrame(frame_ptr, pitch, previous_ptr, previous_pitch, bytes_per_pixel, threshold,
+        height * band / band_count, height * (band + 1) / band_count);
+    });
+    previous = frame;
+  }
+
+  if (!SaveMask(mask_file, stats, frames, vi.IsRGB())) {
+    env->ThrowError("DetectDeadPixels: Unable to write mask file!");
+  }
+}
+
+bool DetectDeadPixels::SaveMask(const char* mask_file, const DeadPixelStats& stats, int frame_count, bool bottom_up) {
+  // 24-bit bitmap, white for dead pixels, rows stored bottom-up
+  int row_size = (stats.width * 3 + 3) & ~3;
+  BITMAPFILEHEADER file_header;
+  BITMAPINFOHEADER info_header;
+  memset(&file_header, 0, sizeof(file_header));
+  memset(&info_header, 0, sizeof(info_header));
+  file_header.bfType = 0x4D42; // "BM"
+  file_header.bfOffBits = sizeof(file_header) + sizeof(info_header);
+  file_header.bfSize = file_header.bfOffBits + row_size * stats.height;
+  info_header.biSize = sizeof(info_header);
+  info_header.biWidth = stats.width;
+  info_header.biHeight = stats.height;
+  info_header.biPlanes = 1;
+  info_header.biBitCount = 24;
+  info_header.biCompression = BI_RGB;
+  info_header.biSizeImage = row_size * stats.height;
+
+  FILE* file;
+  if (fopen_s(&file, mask_file, "wb") != 0) {
+    return false;
+  }
+  bool ok =
+    fwrite(&file_header, sizeof(file_header), 1, file) == 1 &&
+    fwrite(&info_header, sizeof(info_header), 1, file) == 1;
+
+  std::vector<unsigned char> row(row_size);
+  for (int y = 0; y < stats.height && ok; y++) {
+    size_t index = (size_t)(bottom_up ? y : stats.height - 1 - y) * stats.width;
+    for (int x = 0; x < stats.width; x++, index++) {
+      memset(&row[x * 3], stats.IsDead(index, frame_count) ? 255 : 0, 3);
+    }
+    ok = fwrite(row.data(), row_size, 1, file) == 1;
+  }
+  return (fclose(file) == 0) && ok;
+}
+
+AVSValue __cdecl Create_DetectDeadPixels(AVSValue args, void* user_data, IScriptEnvironment* env) {
+  return new DetectDeadPixels(
+    args[0].AsClip(),
+    args[1].AsString(""),
+    args[2].AsInt(100),
+    args[3].AsInt(DEFAULT_OUTLIER_THRESHOLD),
+    args[4].AsInt(0),
+    env);
+}
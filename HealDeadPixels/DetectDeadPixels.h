@@ -0,0 +1,34 @@
+// DetectDeadPixels.h : Builds a HealDeadPixels mask by analyzing footage.
+//
+
+#pragma once
+
+#include "DeadPixelStats.h"
+#include "..\ThreadPool.h"
+
+// Default difference from the neighbor average, per channel, above which a
+// pixel counts as an outlier.
+#define DEFAULT_OUTLIER_THRESHOLD 64
+
+// Analyzes frames of the clip when constructed and writes the mask of dead
+// pixels to a bitmap HealDeadPixels can load. Frames pass through unchanged.
+// YV12 clips are analyzed by their luma plane, which HealDeadPixels derives
+// the chroma recipes from.
+class DetectDeadPixels : public GenericVideoFilter {
+public:
+  DetectDeadPixels(
+    PClip _child,
+    const char* mask_file,
+    int frames,
+    int threshold,
+    int threads,
+    IScriptEnvironment* env
+  );
+
+  // Writes the dead pixels of stats as a bitmap. bottom_up tells whether the
+  // rows of stats come from an RGB frame, which is stored bottom-up like the
+  // bitmap, or from a top-down planar one.
+  static bool SaveMask(const char* mask_file, const DeadPixelStats& stats, int frame_count, bool bottom_up);
+};
+
+AVSValue __cdecl Create_DetectDeadPixels(AVSValue args, void* user_data, IScriptEnvironment* env);
@@ -0,0 +1,214 @@
+// HealAndColorShift.cpp : HealDeadPixels followed by KelvinColorShift in a single pass.
+//
+// Chaining the two filters walks every frame twice, and the second walk finds
+// nothing but the last rows of the first one in cache. This filter heals and
+// shifts the rows of a band in windows of FUSED_WINDOW_ROWS instead.
+
+#include "stdafx.h"
+#include <climits>
+#include <limits>
+#include <mutex>
+#include "HealAndColorShift.h"
+#include "HealKernels.h"
+
+// The rows of a band a heal reads must not have been shifted yet, see ProcessInPlace.
+C_ASSERT(MIN_BAND_HEIGHT >= 2 * MAX_REPLACEMENT_DISTANCE);
+
+// Bands start on tile rows, see GetBandBegin.
+C_ASSERT(MIN_BAND_HEIGHT >= RECIPE_TILE_SIZE);
+
+// Checks what the base class can't, before it loads the mask and generates
+// the recipes. Returns child.
+PClip HealAndColorShift::CheckArguments(PClip child, int from_temp, int to_temp, IScriptEnvironment* env) {
+  if (!child->GetVideoInfo().IsRGB()) {
+    env->ThrowError("HealAndColorShift: Unsupported color format. RGB data only!");
+  }
+  if (from_temp < 1000 || from_temp > 10000 || to_temp < 1000 || to_temp > 10000) {
+    env->ThrowError("HealAndColorShift: Color temperature must be between 1000 and 10000!");
+  }
+  return child;
+}
+
+HealAndColorShift::HealAndColorShift(
+  PClip _child,
+  const char* mask_file,
+  int from_temp,
+  int to_temp,
+  const char* recipe_cache,
+  int threads,
+  const char* stats_file,
+  IScriptEnvironment* env
+  ) : HealDeadPixels(CheckArguments(_child, from_temp, to_temp, env), mask_file, recipe_cache, threads,
+      stats_file, env, "HealAndColorShift"),
+    new_frame_pitch(0) {
+  tables = ColorShiftTables(ComputeColorShift(from_temp, to_temp));
+  shift_row = GetShiftRowFunc(vi.BytesFromPixels(1), env->GetCPUFlags());
+
+  row_recipe_set = recipe_set;
+  row_recipe_set.row_order = true;
+  row_recipes = FindRecipes(row_recipe_set);
+  if (!row_recipes) {
+    std::shared_ptr<PixelHealRecipes> recipes = std::make_shared<PixelHealRecipes>();
+    SortRecipesByRow(*pixel_recipes, vi.height, *recipes, row_starts);
+    row_recipes = RegisterRecipes(row_recipe_set, recipes);
+  } else {
+    GetRowStarts(*row_recipes, vi.height, row_starts);
+  }
+}
+
+// Heals the dead pixels of rows [y_begin, y_end).
+void HealAndColorShift::HealRows(
+  const unsigned char* src,
+  unsigned char* dst,
+  const CompiledPixelHealRecipes& compiled,
+  int y_begin,
+  int y_end
+  ) {
+  if (y_begin < y_end) {
+    heal_pixels(src, dst, *row_recipes, compiled, row_starts[y_begin], row_starts[y_end]);
+  }
+}
+
+void HealAndColorShift::ShiftRows(
+  const unsigned char* src,
+  int src_pitch,
+  unsigned char* dst,
+  int dst_pitch,
+  int y_begin,
+  int y_end
+  ) {
+  for (int y = y_begin; y < y_end; y++) {
+    shift_row(&src[y * src_pitch], &dst[y * dst_pitch], vi.width, tables);
+  }
+}
+
+int HealAndColorShift::GetBandCount() const {
+  int bands = vi.height / MIN_BAND_HEIGHT;
+  if (bands > pool->GetThreadCount()) {
+    bands = pool->GetThreadCount();
+  }
+  return bands > 1 ? bands : 1;
+}
+
+// Returns the first row of the band, or vi.height past the last one. Bands
+// start on a multiple of RECIPE_TILE_SIZE, so that dead pixels of different
+// bands are in different tiles and the AVX2 kernels never gather bytes of a
+// dead pixel another band heals concurrently, see CompiledPixelHealRecipes::byte_reads.
+int HealAndColorShift::GetBandBegin(int band, int bands) const {
+  if (band == bands) {
+    return vi.height;
+  }
+  int tile_rows = vi.height / RECIPE_TILE_SIZE;
+  return tile_rows * band / bands * RECIPE_TILE_SIZE;
+}
+
+// A heal reads rows up to MAX_REPLACEMENT_DISTANCE away, so in place a row may
+// only be shifted once the dead pixels around it are healed. Dead pixels close
+// to a band edge read rows of the neighboring band and are healed first, then
+// each band heals its interior window by window, shifting the rows that no
+// later heal of the band reads.
+void HealAndColorShift::ProcessInPlace(unsigned char* ptr, int pitch, const CompiledPixelHealRecipes& compiled) {
+  int bands = GetBandCount();
+
+  pool->ParallelFor(bands, [&](int band) {
+    int y_begin = GetBandBegin(band, bands);
+    int y_end = GetBandBegin(band + 1, bands);
+    int interior_begin = y_begin + MAX_REPLACEMENT_DISTANCE < y_end ? y_begin + MAX_REPLACEMENT_DISTANCE : y_end;
+    int interior_end = y_end - MAX_REPLACEMENT_DISTANCE > interior_begin ? y_end - MAX_REPLACEMENT_DISTANCE : interior_begin;
+    HealRows(ptr, ptr, compiled, y_begin, interior_begin);
+    HealRows(ptr, ptr, compiled, interior_end, y_end);
+  });
+
+  pool->ParallelFor(bands, [&](int band) {
+    int y_begin = GetBandBegin(band, bands);
+    int y_end = GetBandBegin(band + 1, bands);
+    int interior_begin = y_begin + MAX_REPLACEMENT_DISTANCE < y_end ? y_begin + MAX_REPLACEMENT_DISTANCE : y_end;
+    int interior_end = y_end - MAX_REPLACEMENT_DISTANCE > interior_begin ? y_end - MAX_REPLACEMENT_DISTANCE : interior_begin;
+    int shifted_end = y_begin;
+
+    for (int y = y_begin; y < y_end; y += FUSED_WINDOW_ROWS) {
+      int window_end = y + FUSED_WINDOW_ROWS < y_end ? y + FUSED_WINDOW_ROWS : y_end;
+      int heal_begin = y < interior_begin ? interior_begin : (y > interior_end ? interior_end : y);
+      int heal_end = window_end < interior_begin ? interior_begin : (window_end > interior_end ? interior_end : window_end);
+      HealRows(ptr, ptr, compiled, heal_begin, heal_end);
+
+      int shift_end = window_end == y_end ? y_end : window_end - MAX_REPLACEMENT_DISTANCE;
+      if (shift_end > shifted_end) {
+        ShiftRows(ptr, pitch, ptr, pitch, shifted_end, shift_end);
+        shifted_end = shift_end;
+      }
+    }
+  });
+}
+
+// Heals read src only, so every window is shifted into dst, healed from src and
+// the healed pixels shifted once more in place.
+void HealAndColorShift::ProcessOutOfPlace(
+  const unsigned char* src,
+  unsigned char* dst,
+  int pitch,
+  const CompiledPixelHealRecipes& compiled
+  ) {
+  int bands = GetBandCount();
+
+  pool->ParallelFor(bands, [&](int band) {
+    int y_begin = GetBandBegin(band, bands);
+    int y_end = GetBandBegin(band + 1, bands);
+
+    for (int y = y_begin; y < y_end; y += FUSED_WINDOW_ROWS) {
+      int window_end = y + FUSED_WINDOW_ROWS < y_end ? y + FUSED_WINDOW_ROWS : y_end;
+      ShiftRows(src, pitch, dst, pitch, y, window_end);
+      HealRows(src, dst, compiled, y, window_end);
+      for (size_t i = row_starts[y]; i < row_starts[window_end]; i++) {
+        unsigned char* pixel = dst + compiled.pixel_offsets[i];
+        shift_row(pixel, pixel, 1, tables);
+      }
+    }
+  });
+}
+
+// Returns pixel_recipes in row order compiled for the given pitch.
+std::shared_ptr<const CompiledPixelHealRecipes> HealAndColorShift::GetRowCompiledRecipes(int pitch) {
+  std::lock_guard<std::mutex> lock(row_compiled_mutex);
+  if (!row_compiled || row_compiled->layout.pitch != pitch) {
+    PlaneLayout layout;
+    layout.width = vi.width;
+    layout.height = vi.height;
+    layout.pitch = pitch;
+    layout.bytes_per_pixel = vi.BytesFromPixels(1);
+    layout.bottom_up = true;
+    row_compiled = GetCompiledRecipes(row_recipe_set, *row_recipes, layout);
+  }
+  return row_compiled;
+}
+
+PVideoFrame __stdcall HealAndColorShift::GetFrame(int n, IScriptEnvironment* env) {
+  FrameTimer timer(stats.get());
+  PVideoFrame frame = child->GetFrame(n, env);
+
+  if (!frame->IsWritable()) {
+    timer.SetCopied();
+    // The compiled recipes hold offsets for a single pitch, so a new frame is
+    // only of use if it has the pitch of the source. Once a new frame has shown
+    // that it doesn't, copy the source right away instead of allocating one.
+    int pitch = new_frame_pitch;
+    if (pitch == 0 || pitch == frame->GetPitch()) {
+      PVideoFrame dst = env->NewVideoFrame(vi);
+      new_frame_pitch = dst->GetPitch();
+      if (dst->GetPitch() == frame->GetPitch()) {
+        ProcessOutOfPlace(frame->GetReadPtr(), dst->GetWritePtr(), dst->GetPitch(),
+          *GetRowCompiledRecipes(dst->GetPitch()));
+        return dst;
+      }
+    }
+    env->MakeWritable(&frame);
+  }
+
+  ProcessInPlace(frame->GetWritePtr(), frame->GetPitch(), *GetRowCompiledRecipes(frame->GetPitch()));
+  return frame;
+}
+
+AVSValue __cdecl Create_HealAndColorShift(AVSValue args, void* user_data, IScriptEnvironment* env) {
+  return new HealAndColorShift(args[0].AsClip(), args[1].AsString(""), args[2].AsInt(0), args[3].AsInt(0),
+    args[4].AsString(""), args[5].AsInt(0), args[6].AsString(""), env);
+}
@@ -0,0 +1,71 @@
+// HealAndColorShift.h : HealDeadPixels followed by KelvinColorShift in a single pass.
+//
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "HealDeadPixels.h"
+#include "..\KelvinColorShift\ColorShiftKernels.h"
+
+// Number of rows healed and shifted together, small enough for the rows and
+// the replacement rows around them to stay in L2.
+#define FUSED_WINDOW_ROWS 16
+
+// Heals the dead pixels of an RGB clip and applies a color temperature shift
+// while each band of rows is still in cache, producing the same output as
+// HealDeadPixels(...).KelvinColorShift(...).
+class HealAndColorShift : public HealDeadPixels {
+  ColorShiftTables tables;
+  ShiftRowFunc shift_row;
+
+  // pixel_recipes reordered by row, the dead pixels of row y are
+  // [row_starts[y], row_starts[y + 1]). Shared like them, see RecipeRegistry.h.
+  RecipeSetKey row_recipe_set;
+  std::shared_ptr<const PixelHealRecipes> row_recipes;
+  std::vector<size_t> row_starts;
+  std::shared_ptr<const CompiledPixelHealRecipes> row_compiled;
+  std::mutex row_compiled_mutex;
+
+  // Pitch of the frames env->NewVideoFrame returns for vi, 0 until GetFrame
+  // has allocated one.
+  std::atomic<int> new_frame_pitch;
+
+  void HealRows(
+    const unsigned char* src,
+    unsigned char* dst,
+    const CompiledPixelHealRecipes& compiled,
+    int y_begin,
+    int y_end
+  );
+  void ShiftRows(const unsigned char* src, int src_pitch, unsigned char* dst, int dst_pitch, int y_begin, int y_end);
+  int GetBandCount() const;
+  int GetBandBegin(int band, int bands) const;
+  std::shared_ptr<const CompiledPixelHealRecipes> GetRowCompiledRecipes(int pitch);
+
+  static PClip CheckArguments(PClip child, int from_temp, int to_temp, IScriptEnvironment* env);
+
+  void ProcessInPlace(unsigned char* ptr, int pitch, const CompiledPixelHealRecipes& compiled);
+  void ProcessOutOfPlace(
+    const unsigned char* src,
+    unsigned char* dst,
+    int pitch,
+    const CompiledPixelHealRecipes& compiled
+  );
+
+public:
+  HealAndColorShift(
+    PClip _child,
+    const char* mask_file,
+    int from_temp,
+    int to_temp,
+    const char* recipe_cache,
+    int threads,
+    const char* stats_file,
+    IScriptEnvironment* env
+  );
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+};
+
+AVSValue __cdecl Create_HealAndColorShift(AVSValue args, void* user_data, IScriptEnvironment* env);
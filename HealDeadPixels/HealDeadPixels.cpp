@@ -3,155 +3,207 @@
 
 #include "stdafx.h"
 #include "HealDeadPixels.h"
+#include "HealKernels.h"
+#include "DetectDeadPixels.h"
+#include "HealAndColorShift.h"
+#include "RecipeCache.h"
+#include "..\CpuFeatures.h"
+
+// the kernel dispatchers are passed env->GetCPUFlags()
+C_ASSERT(CPU_FLAG_SSE2 == CPUF_SSE2);
+
+static std::wstring Widen(const char* str) {
+  size_t len = strlen(str);
+  std::wstring str_w(len, 0);
+  std::use_facet<std::ctype<wchar_t> >(std::locale()).widen
+    (&str[0], &str[0] + len, &str_w[0]);
+  return str_w;
+}
 
-HealDeadPixels::HealDeadPixels(PClip _child, const char* mask_file, IScriptEnvironment* env)
-  : GenericVideoFilter(_child) {
-  if (!vi.IsRGB()) {
-    env->ThrowError("HealDeadPixels: Unsupported color format. RGB data only!");
+HealDeadPixels::HealDeadPixels(
+  PClip _child,
+  const char* mask_file,
+  const char* recipe_cache,
+  int threads,
+  const char* stats_file,
+  IScriptEnvironment* env,
+  const char* filter_name
+  ) : GenericVideoFilter(_child), gdiplusToken(0), stats_file(stats_file), filter_name(filter_name) {
+  if (!vi.IsRGB() && !vi.IsYV12()) {
+    env->ThrowError("%s: Unsupported color format. RGB or YV12 data only!", filter_name);
+  }
+  if (threads < 0) {
+    env->ThrowError("%s: Thread count must not be negative!", filter_name);
   }
 
-  size_t len = strlen(mask_file);
-  std::wstring mask_file_w(len, 0);
-  std::use_facet<std::ctype<wchar_t> >(std::locale()).widen
-    (&mask_file[0], &mask_file[0] + len, &mask_file_w[0]);
+  if (!this->stats_file.empty()) {
+    stats.reset(new FilterStats(filter_name));
+  }
+  uint64_t recipes_start = stats ? FilterStats::Now() : 0;
+
+  std::wstring mask_file_w = Widen(mask_file);
+  std::wstring recipe_cache_w = Widen(recipe_cache);
+
+  // the recipes depend on nothing but the mask contents and the frame size, so
+  // they can be shared with other instances and reused across script loads
+  recipe_set.mask_file = mask_file_w;
+  recipe_set.chroma = false;
+  recipe_set.row_order = false;
+  if (!GetRecipeCacheKey(mask_file_w.c_str(), vi, recipe_set.cache_key)) {
+    env->ThrowError("%s: Unable to read mask file!", filter_name);
+  }
+
+  pixel_recipes = FindRecipes(recipe_set);
+  if (!pixel_recipes) {
+    std::shared_ptr<PixelHealRecipes> recipes = std::make_shared<PixelHealRecipes>();
+    bool use_cache = !recipe_cache_w.empty();
+
+    if (!use_cache || !LoadRecipeCache(recipe_cache_w.c_str(), recipe_set.cache_key, *recipes)) {
+      DeadPixelMask mask(vi.width, vi.height);
+      LoadMaskFile(mask_file_w.c_str(), mask, env);
+      GeneratePixelHealRecipes(mask, *recipes);
+
+      if (use_cache) {
+        SaveRecipeCache(recipe_cache_w.c_str(), recipe_set.cache_key, *recipes);
+      }
+    }
+    pixel_recipes = RegisterRecipes(recipe_set, recipes);
+  }
+
+  if (vi.IsYV12()) {
+    // chroma recipes follow from the luma ones, no need to decode the mask again
+    chroma_recipe_set = recipe_set;
+    chroma_recipe_set.chroma = true;
+    chroma_recipes = FindRecipes(chroma_recipe_set);
+    if (!chroma_recipes) {
+      std::shared_ptr<PixelHealRecipes> recipes = std::make_shared<PixelHealRecipes>();
+      GenerateChromaHealRecipes(*pixel_recipes, vi.width / 2, vi.height / 2, *recipes);
+      chroma_recipes = RegisterRecipes(chroma_recipe_set, recipes);
+    }
+  }
+
+  if (stats) {
+    stats->AddRecipes(pixel_recipes->size() + (chroma_recipes ? 2 * chroma_recipes->size() : 0),
+      FilterStats::Now() - recipes_start);
+  }
+
+  heal_pixels = GetHealPixelsFunc(env->GetCPUFlags(), vi.IsRGB() ? vi.BytesFromPixels(1) : 1);
+  pool.reset(new ThreadPool(threads));
+}
 
+HealDeadPixels::~HealDeadPixels() {
+  if (stats) {
+    stats->Dump(stats_file.c_str());
+  }
+  if (gdiplusToken != 0) {
+    Gdiplus::GdiplusShutdown(gdiplusToken);
+  }
+}
+
+void HealDeadPixels::LoadMaskFile(const wchar_t* mask_file, DeadPixelMask& mask, IScriptEnvironment* env) {
   Gdiplus::GdiplusStartupInput gdiplusStartupInput;
   gdiplusStartupInput.GdiplusVersion = 1;
   gdiplusStartupInput.DebugEventCallback = NULL;
   gdiplusStartupInput.SuppressBackgroundThread = FALSE;
   gdiplusStartupInput.SuppressExternalCodecs = FALSE;
   if (GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL) != Gdiplus::Ok) {
-    env->ThrowError("HealDeadPixels: Unable to initialize GDI+!");
+    env->ThrowError("%s: Unable to initialize GDI+!", filter_name.c_str());
   }
 
-  std::unique_ptr<Gdiplus::Bitmap> bitmap(new Gdiplus::Bitmap(mask_file_w.c_str()));
+  std::unique_ptr<Gdiplus::Bitmap> bitmap(new Gdiplus::Bitmap(mask_file));
   if (bitmap->GetWidth() != vi.width || bitmap->GetHeight() != vi.height) {
-    env->ThrowError("HealDeadPixels: Mask bitmap does not match frame size!");
+    env->ThrowError("%s: Mask bitmap does not match frame size!", filter_name.c_str());
   }
-  GeneratePixelHealRecipes(bitmap);
+  LoadMask(bitmap, mask, env);
 }
 
-HealDeadPixels::~HealDeadPixels() {
-  Gdiplus::GdiplusShutdown(gdiplusToken);
-}
+void HealDeadPixels::LoadMask(
+  std::unique_ptr<Gdiplus::Bitmap> &bitmap,
+  DeadPixelMask& mask,
+  IScriptEnvironment* env
+  ) {
+  int width = mask.GetWidth();
+  int height = mask.GetHeight();
+
+  // decode the whole bitmap at once, GetPixel is far too slow to call per pixel
+  Gdiplus::Rect rect(0, 0, width, height);
+  Gdiplus::BitmapData data;
+  if (bitmap->LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &data) != Gdiplus::Ok) {
+    env->ThrowError("%s: Unable to read mask bitmap!", filter_name.c_str());
+  }
 
-void HealDeadPixels::GeneratePixelHealRecipes(std::unique_ptr<Gdiplus::Bitmap> &bitmap) {
-  int bitmap_width = bitmap->GetWidth();
-  int bitmap_height = bitmap->GetHeight();
-
-  for (int y = 0; y < bitmap_height; y++) {
-    for (int x = 0; x < bitmap_width; x++) {
-      if (IsDeadPixel(bitmap, x, y)) {
-        // dead pixel, create its heal recipe
-        PixelHealRecipe recipe(x, y);
-
-        // first pass, find replacement pixels
-        int idx = 0;
-        for (int distance = 1;
-             distance <= MAX_REPLACEMENT_DISTANCE && idx < MAX_REPLACEMENT_PIXELS;
-             distance++) {
-          for (int i = 0; i < 4 * distance; i++) {
-            int offset = i / 4;
-            int x_factor = (i & 1) ? 1 : -1;
-            int y_factor = (i & 2) ? 1 : -1;
-            recipe.replacements[idx].offset_x = x_factor * offset;
-            recipe.replacements[idx].offset_y = y_factor * (distance - offset);
-
-            int bitmap_x = recipe.frame_x + recipe.replacements[idx].offset_x;
-            int bitmap_y = recipe.frame_y + recipe.replacements[idx].offset_y;
-            if (!IsDeadPixel(bitmap, bitmap_x, bitmap_y)) {
-              // this is a usable replacement, move to next index
-              if (++idx >= MAX_REPLACEMENT_PIXELS) {
-                break;
-              }
-              recipe.replacements[idx] = recipe.replacements[idx - 1];
-            }
-          }
-        }
-
-        // second pass, compute weights
-        int distance_sum = 0;
-        for (int i = 0; i < idx; i++) {
-          // TODO: eliminate floating point arithmetics
-          double distance = sqrt(
-            recipe.replacements[i].offset_x * recipe.replacements[i].offset_x +
-            recipe.replacements[i].offset_y * recipe.replacements[i].offset_y);
-          distance = UINT16_MAX / pow(M_E, distance);
-          recipe.replacements[i].weight = (int)distance;
-          distance_sum += (int)distance;
-        }
-        for (int i = 0; i < idx; i++) {
-          recipe.replacements[i].weight =
-            (UINT16_MAX * (int)recipe.replacements[i].weight) / distance_sum;
-        }
-        for (int i = idx; i < MAX_REPLACEMENT_PIXELS; i++) {
-          recipe.replacements[i].offset_x = 0;
-          recipe.replacements[i].offset_y = 0;
-          recipe.replacements[i].weight = 0;
-        }
-        pixel_recipes.push_back(std::move(recipe));
+  for (int row = 0; row < height; row++) {
+    const Gdiplus::ARGB* line = (const Gdiplus::ARGB*)((const BYTE*)data.Scan0 + row * data.Stride);
+    for (int x = 0; x < width; x++) {
+      Gdiplus::Color color(line[x]);
+      if (color.GetR() >= 128 || color.GetG() >= 128 || color.GetB() >= 128) {
+        // bitmaps are top-down, RGB frames bottom-up
+        mask.SetDead(x, height - row - 1);
       }
     }
   }
+
+  bitmap->UnlockBits(&data);
 }
 
-bool HealDeadPixels::IsDeadPixel(
-  std::unique_ptr<Gdiplus::Bitmap> &bitmap,
-  int x,
-  int y
+void HealDeadPixels::HealPlane(
+  unsigned char* ptr,
+  int pitch,
+  int width,
+  int height,
+  const RecipeSetKey& key,
+  const PixelHealRecipes& recipes,
+  std::shared_ptr<const CompiledPixelHealRecipes>& compiled_ptr
   ) {
-  if (x < 0 || (UINT)x >= bitmap->GetWidth() ||
-      y < 0 || (UINT)y >= bitmap->GetHeight()) {
-    // pixel outside of the frame is dead by default
-    return true;
-  }
-  Gdiplus::Color color;
-  bitmap->GetPixel(x, bitmap->GetHeight() - y - 1, &color);
-  return (color.GetR() >= 128 || color.GetG() >= 128 || color.GetB() >= 128);
+  // GetFrame may be called on several threads at once, and the frames of
+  // one clip may come with different pitches
+  std::shared_ptr<const CompiledPixelHealRecipes> compiled;
+  {
+    std::lock_guard<std::mutex> lock(compiled_mutex);
+    if (!compiled_ptr || compiled_ptr->layout.pitch != pitch) {
+      PlaneLayout layout;
+      layout.width = width;
+      layout.height = height;
+      layout.pitch = pitch;
+      layout.bytes_per_pixel = vi.IsRGB() ? vi.BytesFromPixels(1) : 1;
+      layout.bottom_up = vi.IsRGB();
+      compiled_ptr = GetCompiledRecipes(key, recipes, layout);
+    }
+    compiled = compiled_ptr;
+  }
+  HealPlaneTiles(ptr, recipes, *compiled, heal_pixels, *pool);
 }
 
 PVideoFrame __stdcall HealDeadPixels::GetFrame(int n, IScriptEnvironment* env) {
 
+  FrameTimer timer(stats.get());
   PVideoFrame frame = child->GetFrame(n, env);
+  if (!frame->IsWritable()) {
+    timer.SetCopied();
+  }
   env->MakeWritable(&frame);
 
-  unsigned char* ptr = frame->GetWritePtr();
-  int pitch = frame->GetPitch();
-
-  int bytes_per_pixel = vi.IsRGB24() ? 3 : 4;
-#define FRAME_XY_TO_INDEX(x, y) ((y) * pitch) + ((x) * bytes_per_pixel)
-
-  // iterate over the recipes and fix all dead pixels one by one - done with
-  // integer calculations only
-  for (const auto& recipe : pixel_recipes) {
-    int avg_r = 0, avg_g = 0, avg_b = 0;
-    for (int i = 0; i < MAX_REPLACEMENT_PIXELS; i++) {
-      if (recipe.replacements[i].weight > 0) {
-        size_t index = FRAME_XY_TO_INDEX(
-          recipe.frame_x + recipe.replacements[i].offset_x,
-          recipe.frame_y + recipe.replacements[i].offset_y);
-        avg_b += (int)recipe.replacements[i].weight * ptr[index];
-        avg_g += (int)recipe.replacements[i].weight * ptr[index + 1];
-        avg_r += (int)recipe.replacements[i].weight * ptr[index + 2];
-      }
-    }
-    size_t index = FRAME_XY_TO_INDEX(
-      recipe.frame_x,
-      recipe.frame_y);
-    ptr[index] = avg_b / UINT16_MAX;
-    ptr[index + 1] = avg_g / UINT16_MAX;
-    ptr[index + 2] = avg_r / UINT16_MAX;
+  HealPlane(frame->GetWritePtr(), frame->GetPitch(), vi.width, vi.height,
+    recipe_set, *pixel_recipes, compiled_recipes);
+
+  if (vi.IsYV12()) {
+    // both chroma planes share one pitch and thus one set of compiled recipes
+    HealPlane(frame->GetWritePtr(PLANAR_U), frame->GetPitch(PLANAR_U), vi.width / 2, vi.height / 2,
+      chroma_recipe_set, *chroma_recipes, compiled_chroma_recipes);
+    HealPlane(frame->GetWritePtr(PLANAR_V), frame->GetPitch(PLANAR_V), vi.width / 2, vi.height / 2,
+      chroma_recipe_set, *chroma_recipes, compiled_chroma_recipes);
   }
 
-#undef FRAME_XY_TO_INDEX
   return frame;
 }
 
 AVSValue __cdecl Create_HealDeadPixels(AVSValue args, void* user_data, IScriptEnvironment* env) {
-  return new HealDeadPixels(args[0].AsClip(), args[1].AsString(""), env);
+  return new HealDeadPixels(args[0].AsClip(), args[1].AsString(""), args[2].AsString(""), args[3].AsInt(0), args[4].AsString(""), env);
 }
 
 extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit2(IScriptEnvironment* env) {
-  env->AddFunction("HealDeadPixels", "c[mask_image]s", Create_HealDeadPixels, 0);
+  env->AddFunction("HealDeadPixels", "c[mask_image]s[recipe_cache]s[threads]i[stats_file]s", Create_HealDeadPixels, 0);
+  env->AddFunction("DetectDeadPixels", "c[mask_image]s[frames]i[threshold]i[threads]i", Create_DetectDeadPixels, 0);
+  env->AddFunction("HealAndColorShift", "c[mask_image]s[from_temp]i[to_temp]i[recipe_cache]s[threads]i[stats_file]s", Create_HealAndColorShift, 0);
   return "Dead pixel removal plugin";
 }
@@ -1,36 +1,59 @@
-// Maximum number of neighboring pixels whose values will be used to fix a dead one.
-#define MAX_REPLACEMENT_PIXELS 24
-
-// Maximum distance (in x+y) of neighboring pixels whose values will be used to fix a dead one.
-#define MAX_REPLACEMENT_DISTANCE 10
-
-// Describes one dead pixel
-struct PixelHealRecipe {
-  PixelHealRecipe(int x, int y)
-    : frame_x(x), frame_y(y) {
-  }
-  int frame_x;
-  int frame_y;
-  struct {
-    int8_t offset_x;
-    int8_t offset_y;
-    uint16_t weight; // 0 = 0%, UINT16_MAX = 100%
-  } replacements[MAX_REPLACEMENT_PIXELS];
-};
+#pragma once
+
+#include <mutex>
+#include "HealRecipes.h"
+#include "RecipeRegistry.h"
+#include "..\FilterStats.h"
+#include "..\ThreadPool.h"
 
 class HealDeadPixels : public GenericVideoFilter {
-  std::vector<PixelHealRecipe> pixel_recipes;
+protected:
+  // shared with other instances using the same mask, see RecipeRegistry.h
+  RecipeSetKey recipe_set;
+  RecipeSetKey chroma_recipe_set;
+  std::shared_ptr<const PixelHealRecipes> pixel_recipes;
+  std::shared_ptr<const PixelHealRecipes> chroma_recipes;
+  std::shared_ptr<const CompiledPixelHealRecipes> compiled_recipes;
+  std::shared_ptr<const CompiledPixelHealRecipes> compiled_chroma_recipes;
+  std::mutex compiled_mutex; // guards compiled_recipes and compiled_chroma_recipes
+  HealPixelsFunc heal_pixels;
+  std::unique_ptr<ThreadPool> pool;
   ULONG_PTR gdiplusToken;
 
+  // only with a stats file
+  std::unique_ptr<FilterStats> stats;
+  std::string stats_file;
+
+  // HealDeadPixels or the name of a derived filter, for error messages
+  std::string filter_name;
+
 public:
-  HealDeadPixels(PClip _child, const char* mask_file, IScriptEnvironment* env);
+  HealDeadPixels(
+    PClip _child,
+    const char* mask_file,
+    const char* recipe_cache,
+    int threads,
+    const char* stats_file,
+    IScriptEnvironment* env,
+    const char* filter_name = "HealDeadPixels"
+  );
   ~HealDeadPixels();
 
-  void GeneratePixelHealRecipes(std::unique_ptr<Gdiplus::Bitmap> &bitmap);
-  static bool IsDeadPixel(
+  void LoadMaskFile(const wchar_t* mask_file, DeadPixelMask& mask, IScriptEnvironment* env);
+  void LoadMask(
     std::unique_ptr<Gdiplus::Bitmap> &bitmap,
-    int x,
-    int y
+    DeadPixelMask& mask,
+    IScriptEnvironment* env
+  );
+
+  void HealPlane(
+    unsigned char* ptr,
+    int pitch,
+    int width,
+    int height,
+    const RecipeSetKey& key,
+    const PixelHealRecipes& recipes,
+    std::shared_ptr<const CompiledPixelHealRecipes>& compiled
   );
 
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
@@ -0,0 +1,104 @@
+// HealKernels.cpp : Scalar heal kernels, CPU dispatch.
+//
+
+#include "HealKernels.h"
+#include "../CpuFeatures.h"
+
+#include <cstring>
+
+void HealPixels_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+
+  // iterate over the recipes and fix all dead pixels one by one - done with
+  // integer calculations only
+  for (size_t i = begin; i < end; i++) {
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    int avg_r = 0, avg_g = 0, avg_b = 0;
+    for (uint32_t j = starts[i]; j < starts[i + 1]; j++) {
+      const unsigned char* replacement = pixel + offsets[j];
+      avg_b += (int)weights[j] * replacement[0];
+      avg_g += (int)weights[j] * replacement[1];
+      avg_r += (int)weights[j] * replacement[2];
+    }
+    out[0] = avg_b / UINT16_MAX;
+    out[1] = avg_g / UINT16_MAX;
+    out[2] = avg_r / UINT16_MAX;
+  }
+}
+
+void HealPixelsRGB32_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+
+  for (size_t i = begin; i < end; i++) {
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    int avg_r = 0, avg_g = 0, avg_b = 0;
+    for (uint32_t j = starts[i]; j < starts[i + 1]; j++) {
+      uint32_t replacement;
+      memcpy(&replacement, pixel + offsets[j], 4);
+      avg_b += (int)weights[j] * (int)(replacement & 0xFF);
+      avg_g += (int)weights[j] * (int)((replacement >> 8) & 0xFF);
+      avg_r += (int)weights[j] * (int)((replacement >> 16) & 0xFF);
+    }
+
+    // three byte stores leave alpha alone, a masked 32-bit store would need
+    // to load it first and measured slower
+    out[0] = avg_b / UINT16_MAX;
+    out[1] = avg_g / UINT16_MAX;
+    out[2] = avg_r / UINT16_MAX;
+  }
+}
+
+void HealPlanePixels_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+
+  for (size_t i = begin; i < end; i++) {
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    int avg = 0;
+    for (uint32_t j = starts[i]; j < starts[i + 1]; j++) {
+      avg += (int)weights[j] * pixel[offsets[j]];
+    }
+    out[0] = avg / UINT16_MAX;
+  }
+}
+
+HealPixelsFunc GetHealPixelsFunc(long cpu_flags, int bytes_per_pixel) {
+  bool avx2 = (cpu_flags & CPU_FLAG_SSE2) && IsAVX2Supported();
+  switch (bytes_per_pixel) {
+  case 1:
+    return avx2 ? HealPlanePixels_AVX2 : HealPlanePixels_C;
+  case 4:
+    return avx2 ? HealPixelsRGB32_AVX2 : HealPixelsRGB32_C;
+  default:
+    return avx2 ? HealPixels_AVX2 : HealPixels_C;
+  }
+}
@@ -0,0 +1,68 @@
+// HealKernels.h : Kernels computing the weighted average of replacement pixels.
+//
+// All variants use integer arithmetic only and produce identical results.
+
+#pragma once
+
+#include "HealRecipes.h"
+
+// BGR pixels of RGB24 and RGB32 frames
+void HealPixels_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+void HealPixels_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+// BGRA pixels of RGB32 frames. Replacements are read as whole 32-bit words,
+// which are always inside the frame, and the alpha byte is kept.
+void HealPixelsRGB32_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+void HealPixelsRGB32_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+// single byte samples of planar formats
+void HealPlanePixels_C(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+void HealPlanePixels_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+// Picks the fastest heal kernel for the given CPUF_* flags and pixel size.
+HealPixelsFunc GetHealPixelsFunc(long cpu_flags, int bytes_per_pixel);
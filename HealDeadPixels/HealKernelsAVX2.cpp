@@ -0,0 +1,163 @@
+// HealKernelsAVX2.cpp : AVX2 heal kernels gathering eight replacement pixels at a time.
+//
+// Only called after IsAVX2Supported() returned true.
+
+#include "HealKernels.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+static inline int HorizontalSum(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+void HealPixels_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+
+  for (size_t i = begin; i < end; i++) {
+    if (compiled.pixel_offsets[i] > compiled.gather_limit || compiled.byte_reads[i]) {
+      // a 32-bit read of some replacement could run past the end of the frame
+      // or take in a pixel another thread writes
+      HealPixels_C(src, dst, recipes, compiled, i, i + 1);
+      continue;
+    }
+
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    __m256i sum_b = _mm256_setzero_si256();
+    __m256i sum_g = _mm256_setzero_si256();
+    __m256i sum_r = _mm256_setzero_si256();
+
+    uint32_t j = starts[i];
+    uint32_t j_end = starts[i + 1];
+    for (; j + 8 <= j_end; j += 8) {
+      __m256i px = _mm256_i32gather_epi32(
+        (const int*)pixel, _mm256_loadu_si256((const __m256i*)&offsets[j]), 1);
+      __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&weights[j]));
+      sum_b = _mm256_add_epi32(sum_b, _mm256_mullo_epi32(_mm256_and_si256(px, mask), w));
+      sum_g = _mm256_add_epi32(sum_g,
+        _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask), w));
+      sum_r = _mm256_add_epi32(sum_r,
+        _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask), w));
+    }
+
+    int avg_b = HorizontalSum(sum_b);
+    int avg_g = HorizontalSum(sum_g);
+    int avg_r = HorizontalSum(sum_r);
+    for (; j < j_end; j++) {
+      const unsigned char* replacement = pixel + offsets[j];
+      avg_b += (int)weights[j] * replacement[0];
+      avg_g += (int)weights[j] * replacement[1];
+      avg_r += (int)weights[j] * replacement[2];
+    }
+    out[0] = avg_b / UINT16_MAX;
+    out[1] = avg_g / UINT16_MAX;
+    out[2] = avg_r / UINT16_MAX;
+  }
+}
+
+void HealPixelsRGB32_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+
+  // RGB32 replacements are whole words inside the frame, so unlike
+  // HealPixels_AVX2 no gather can run past its end or into another pixel
+  for (size_t i = begin; i < end; i++) {
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    __m256i sum_b = _mm256_setzero_si256();
+    __m256i sum_g = _mm256_setzero_si256();
+    __m256i sum_r = _mm256_setzero_si256();
+
+    uint32_t j = starts[i];
+    uint32_t j_end = starts[i + 1];
+    for (; j + 8 <= j_end; j += 8) {
+      __m256i px = _mm256_i32gather_epi32(
+        (const int*)pixel, _mm256_loadu_si256((const __m256i*)&offsets[j]), 1);
+      __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&weights[j]));
+      sum_b = _mm256_add_epi32(sum_b, _mm256_mullo_epi32(_mm256_and_si256(px, mask), w));
+      sum_g = _mm256_add_epi32(sum_g,
+        _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask), w));
+      sum_r = _mm256_add_epi32(sum_r,
+        _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask), w));
+    }
+
+    int avg_b = HorizontalSum(sum_b);
+    int avg_g = HorizontalSum(sum_g);
+    int avg_r = HorizontalSum(sum_r);
+    for (; j < j_end; j++) {
+      uint32_t replacement;
+      memcpy(&replacement, pixel + offsets[j], 4);
+      avg_b += (int)weights[j] * (int)(replacement & 0xFF);
+      avg_g += (int)weights[j] * (int)((replacement >> 8) & 0xFF);
+      avg_r += (int)weights[j] * (int)((replacement >> 16) & 0xFF);
+    }
+
+    // see HealPixelsRGB32_C
+    out[0] = avg_b / UINT16_MAX;
+    out[1] = avg_g / UINT16_MAX;
+    out[2] = avg_r / UINT16_MAX;
+  }
+}
+
+void HealPlanePixels_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+  ) {
+  const uint32_t* starts = recipes.starts.data();
+  const uint16_t* weights = recipes.weights.data();
+  const int* offsets = compiled.offsets.data();
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+
+  for (size_t i = begin; i < end; i++) {
+    if (compiled.pixel_offsets[i] > compiled.gather_limit || compiled.byte_reads[i]) {
+      HealPlanePixels_C(src, dst, recipes, compiled, i, i + 1);
+      continue;
+    }
+
+    const unsigned char* pixel = src + compiled.pixel_offsets[i];
+    unsigned char* out = dst + compiled.pixel_offsets[i];
+    __m256i sum = _mm256_setzero_si256();
+
+    uint32_t j = starts[i];
+    uint32_t j_end = starts[i + 1];
+    for (; j + 8 <= j_end; j += 8) {
+      __m256i px = _mm256_i32gather_epi32(
+        (const int*)pixel, _mm256_loadu_si256((const __m256i*)&offsets[j]), 1);
+      __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&weights[j]));
+      sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_and_si256(px, mask), w));
+    }
+
+    int avg = HorizontalSum(sum);
+    for (; j < j_end; j++) {
+      avg += (int)weights[j] * pixel[offsets[j]];
+    }
+    out[0] = avg / UINT16_MAX;
+  }
+}
@@ -0,0 +1,286 @@
+// HealRecipes.cpp : Dead pixel masks and the recipes healing them.
+//
+
+#include "HealRecipes.h"
+#include "../ThreadPool.h"
+
+#include <climits>
+#include <cstdlib>
+
+// Unnormalized weight of a replacement pixel, UINT16_MAX / e^distance truncated
+// to an integer, where distance is the Euclidean length of the offset. Indexed
+// by the absolute values of offset_y and offset_x. Precomputed so that recipe
+// generation is free of floating point and gives the same weights everywhere.
+static const uint16_t REPLACEMENT_WEIGHTS[MAX_REPLACEMENT_DISTANCE + 1][MAX_REPLACEMENT_DISTANCE + 1] = {
+  {     0,24108, 8869, 3262, 1200,  441,  162,   59,   21,    8,    2 },
+  { 24108,15932, 7004, 2774, 1061,  399,  149,   55,   20,    7,    0 },
+  {  8869, 7004, 3873, 1780,  748,  300,  117,   45,   17,    0,    0 },
+  {  3262, 2774, 1780,  941,  441,  192,   80,   32,    0,    0,    0 },
+  {  1200, 1061,  748,  441,  228,  108,   48,    0,    0,    0,    0 },
+  {   441,  399,  300,  192,  108,   55,    0,    0,    0,    0,    0 },
+  {   162,  149,  117,   80,   48,    0,    0,    0,    0,    0,    0 },
+  {    59,   55,   45,   32,    0,    0,    0,    0,    0,    0,    0 },
+  {    21,   20,   17,    0,    0,    0,    0,    0,    0,    0,    0 },
+  {     8,    7,    0,    0,    0,    0,    0,    0,    0,    0,    0 },
+  {     2,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0 },
+};
+static_assert(MAX_REPLACEMENT_DISTANCE == 10, "REPLACEMENT_WEIGHTS must match MAX_REPLACEMENT_DISTANCE");
+
+DeadPixelMask::DeadPixelMask(int width, int height)
+  : width(width), height(height), padded_width(width + 2 * MAX_REPLACEMENT_DISTANCE) {
+  int padded_height = height + 2 * MAX_REPLACEMENT_DISTANCE;
+  bits.resize(((size_t)padded_width * padded_height + 63) / 64);
+
+  // pixels outside of the frame are dead by default
+  for (int y = -MAX_REPLACEMENT_DISTANCE; y < height + MAX_REPLACEMENT_DISTANCE; y++) {
+    bool inside = (y >= 0 && y < height);
+    for (int x = -MAX_REPLACEMENT_DISTANCE; x < width + MAX_REPLACEMENT_DISTANCE; x++) {
+      if (inside && x == 0) {
+        x = width;
+      }
+      SetDead(x, y);
+    }
+  }
+}
+
+int DeadPixelMask::FindDead(int from, int end, int y) const {
+  for (int x = from; x < end; x++) {
+    size_t i = BitIndex(x, y);
+    uint64_t word = bits[i >> 6] >> (i & 63);
+    if (word == 0) {
+      // no dead pixel in the rest of this word
+      x += 63 - (int)(i & 63);
+    } else if (word & 1) {
+      return x;
+    }
+  }
+  return end;
+}
+
+void GeneratePixelHealRecipes(const DeadPixelMask& mask, PixelHealRecipes& recipes) {
+  int width = mask.GetWidth();
+  int height = mask.GetHeight();
+
+  // walk the mask tile by tile so that the recipes come out in tile order
+  for (int tile_y = 0; tile_y < height; tile_y += RECIPE_TILE_SIZE) {
+    int tile_y_end = tile_y + RECIPE_TILE_SIZE < height ? tile_y + RECIPE_TILE_SIZE : height;
+    for (int tile_x = 0; tile_x < width; tile_x += RECIPE_TILE_SIZE) {
+      int tile_x_end = tile_x + RECIPE_TILE_SIZE < width ? tile_x + RECIPE_TILE_SIZE : width;
+      for (int y = tile_y; y < tile_y_end; y++) {
+        for (int x = mask.FindDead(tile_x, tile_x_end, y);
+             x < tile_x_end;
+             x = mask.FindDead(x + 1, tile_x_end, y)) {
+          // dead pixel, create its heal recipe
+          struct {
+            int offset_x;
+            int offset_y;
+            int weight;
+          } replacements[MAX_REPLACEMENT_PIXELS];
+
+          // first pass, find replacement pixels
+          int idx = 0;
+          for (int distance = 1;
+               distance <= MAX_REPLACEMENT_DISTANCE && idx < MAX_REPLACEMENT_PIXELS;
+               distance++) {
+            for (int i = 0; i < 4 * distance; i++) {
+              int offset = i / 4;
+              int x_factor = (i & 1) ? 1 : -1;
+              int y_factor = (i & 2) ? 1 : -1;
+              replacements[idx].offset_x = x_factor * offset;
+              replacements[idx].offset_y = y_factor * (distance - offset);
+
+              if (!mask.IsDead(x + replacements[idx].offset_x, y + replacements[idx].offset_y)) {
+                // this is a usable replacement, move to next index
+                if (++idx >= MAX_REPLACEMENT_PIXELS) {
+                  break;
+                }
+              }
+            }
+          }
+
+          // second pass, compute weights
+          int distance_sum = 0;
+          for (int i = 0; i < idx; i++) {
+            replacements[i].weight = REPLACEMENT_WEIGHTS
+              [abs(replacements[i].offset_y)][abs(replacements[i].offset_x)];
+            distance_sum += replacements[i].weight;
+          }
+
+          // store only the replacements which contribute to the result
+          recipes.frame_x.push_back(x);
+          recipes.frame_y.push_back(y);
+          for (int i = 0; i < idx; i++) {
+            uint16_t weight = (uint16_t)((UINT16_MAX * replacements[i].weight) / distance_sum);
+            if (weight > 0) {
+              recipes.offset_x.push_back((int8_t)replacements[i].offset_x);
+              recipes.offset_y.push_back((int8_t)replacements[i].offset_y);
+              recipes.weights.push_back(weight);
+            }
+          }
+          recipes.starts.push_back((uint32_t)recipes.weights.size());
+        }
+      }
+    }
+  }
+}
+
+void GenerateChromaHealRecipes(
+  const PixelHealRecipes& luma_recipes,
+  int width,
+  int height,
+  PixelHealRecipes& recipes
+  ) {
+  // a chroma sample is dead if any of the luma pixels it covers is, which works
+  // in frame coordinates as long as the luma height is even
+  DeadPixelMask mask(width, height);
+  for (size_t i = 0; i < luma_recipes.size(); i++) {
+    mask.SetDead(luma_recipes.frame_x[i] / 2, luma_recipes.frame_y[i] / 2);
+  }
+  GeneratePixelHealRecipes(mask, recipes);
+}
+
+void GetRowStarts(const PixelHealRecipes& recipes, int height, std::vector<size_t>& row_starts) {
+  row_starts.assign(height + 1, 0);
+  for (size_t i = 0; i < recipes.size(); i++) {
+    row_starts[recipes.frame_y[i] + 1]++;
+  }
+  for (int y = 0; y < height; y++) {
+    row_starts[y + 1] += row_starts[y];
+  }
+}
+
+void SortRecipesByRow(
+  const PixelHealRecipes& recipes,
+  int height,
+  PixelHealRecipes& sorted,
+  std::vector<size_t>& row_starts
+  ) {
+  GetRowStarts(recipes, height, row_starts);
+
+  // counting sort, keeps the pixels of a row in tile order
+  std::vector<size_t> order(recipes.size());
+  std::vector<size_t> next(row_starts.begin(), row_starts.end() - 1);
+  for (size_t i = 0; i < recipes.size(); i++) {
+    order[next[recipes.frame_y[i]]++] = i;
+  }
+
+  sorted = PixelHealRecipes();
+  sorted.frame_x.reserve(recipes.size());
+  sorted.frame_y.reserve(recipes.size());
+  sorted.starts.reserve(recipes.size() + 1);
+  sorted.offset_x.reserve(recipes.offset_x.size());
+  sorted.offset_y.reserve(recipes.offset_y.size());
+  sorted.weights.reserve(recipes.weights.size());
+  for (size_t k = 0; k < order.size(); k++) {
+    size_t i = order[k];
+    sorted.frame_x.push_back(recipes.frame_x[i]);
+    sorted.frame_y.push_back(recipes.frame_y[i]);
+    sorted.offset_x.insert(sorted.offset_x.end(),
+      recipes.offset_x.begin() + recipes.starts[i], recipes.offset_x.begin() + recipes.starts[i + 1]);
+    sorted.offset_y.insert(sorted.offset_y.end(),
+      recipes.offset_y.begin() + recipes.starts[i], recipes.offset_y.begin() + recipes.starts[i + 1]);
+    sorted.weights.insert(sorted.weights.end(),
+      recipes.weights.begin() + recipes.starts[i], recipes.weights.begin() + recipes.starts[i + 1]);
+    sorted.starts.push_back((uint32_t)sorted.weights.size());
+  }
+}
+
+void CompiledPixelHealRecipes::Compile(const PixelHealRecipes& recipes, const PlaneLayout& layout) {
+  int pitch = layout.pitch;
+  int bytes_per_pixel = layout.bytes_per_pixel;
+  this->layout = layout;
+
+  if (bytes_per_pixel == 4) {
+    gather_limit = INT_MAX;
+  } else {
+    int plane_size = pitch * (layout.height - 1) + layout.width * bytes_per_pixel;
+    gather_limit = plane_size - 4 - MAX_REPLACEMENT_DISTANCE * (pitch + bytes_per_pixel);
+  }
+
+  // recipes are in bottom-up frame coordinates
+  int row_pitch = layout.bottom_up ? pitch : -pitch;
+  int first_row = layout.bottom_up ? 0 : (layout.height - 1) * pitch;
+
+  pixel_offsets.resize(recipes.size());
+  for (size_t i = 0; i < recipes.size(); i++) {
+    pixel_offsets[i] = first_row + recipes.frame_y[i] * row_pitch + recipes.frame_x[i] * bytes_per_pixel;
+  }
+
+  offsets.resize(recipes.weights.size());
+  for (size_t i = 0; i < recipes.weights.size(); i++) {
+    offsets[i] = recipes.offset_y[i] * row_pitch + recipes.offset_x[i] * bytes_per_pixel;
+  }
+
+  tile_starts.clear();
+  int tiles_per_row = (layout.width + RECIPE_TILE_SIZE - 1) / RECIPE_TILE_SIZE;
+  auto get_tile = [tiles_per_row](int x, int y) {
+    return (y / RECIPE_TILE_SIZE) * tiles_per_row + x / RECIPE_TILE_SIZE;
+  };
+  int previous_tile = -1;
+  for (size_t i = 0; i < recipes.size(); i++) {
+    int tile = get_tile(recipes.frame_x[i], recipes.frame_y[i]);
+    if (tile != previous_tile) {
+      tile_starts.push_back(i);
+      previous_tile = tile;
+    }
+  }
+  tile_starts.push_back(recipes.size());
+
+  // A 32-bit read of a replacement takes in the first bytes of the pixels
+  // following it in the row, up to three of them for single byte samples.
+  // Another thread may be healing those if they are dead and in another tile,
+  // or shifting the next row if the read runs past the end of this one (see
+  // HealAndColorShift), so such dead pixels are healed with byte reads.
+  byte_reads.assign(recipes.size(), 0);
+  if (bytes_per_pixel < 4) {
+    int width = layout.width;
+    std::vector<bool> dead((size_t)width * layout.height);
+    for (size_t i = 0; i < recipes.size(); i++) {
+      dead[(size_t)recipes.frame_y[i] * width + recipes.frame_x[i]] = true;
+    }
+
+    int spill = 3 / bytes_per_pixel;
+    for (size_t i = 0; i < recipes.size(); i++) {
+      int x = recipes.frame_x[i];
+      int y = recipes.frame_y[i];
+      int tile = get_tile(x, y);
+      for (uint32_t j = recipes.starts[i]; j < recipes.starts[i + 1] && !byte_reads[i]; j++) {
+        int rx = x + recipes.offset_x[j];
+        int ry = y + recipes.offset_y[j];
+        if (rx * bytes_per_pixel + 4 > pitch) {
+          byte_reads[i] = 1;
+          break;
+        }
+        for (int n = rx + 1; n <= rx + spill && n < width; n++) {
+          if (dead[(size_t)ry * width + n] && get_tile(n, ry) != tile) {
+            byte_reads[i] = 1;
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+void HealPlaneTiles(
+  unsigned char* ptr,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  HealPixelsFunc heal_pixels,
+  ThreadPool& pool
+  ) {
+  // Replacement pixels are never dead, so no recipe reads what another one
+  // writes and the tiles can be healed in any order. The kernels read bytes
+  // of dead pixels beyond the replacements only within the same tile, see
+  // CompiledPixelHealRecipes::byte_reads.
+  int tile_count = (int)compiled.tile_starts.size() - 1;
+  int task_count = pool.GetThreadCount() * HEAL_TASKS_PER_THREAD;
+  if (task_count > tile_count) {
+    task_count = tile_count;
+  }
+  pool.ParallelFor(task_count, [&](int task) {
+    size_t begin = compiled.tile_starts[(size_t)tile_count * task / task_count];
+    size_t end = compiled.tile_starts[(size_t)tile_count * (task + 1) / task_count];
+    heal_pixels(ptr, ptr, recipes, compiled, begin, end);
+  });
+}
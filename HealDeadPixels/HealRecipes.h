@@ -0,0 +1,176 @@
+// HealRecipes.h : Dead pixel masks and the recipes healing them.
+//
+// Free of AviSynth and Windows dependencies, see CMakeLists.txt.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class ThreadPool;
+
+// Maximum number of neighboring pixels whose values will be used to fix a dead one.
+#define MAX_REPLACEMENT_PIXELS 24
+
+// Maximum distance (in x+y) of neighboring pixels whose values will be used to fix a dead one.
+#define MAX_REPLACEMENT_DISTANCE 10
+
+// Width and height of the tiles recipes are grouped by. A tile's dead pixels and
+// the rows around them stay in L1/L2 while it is healed.
+#define RECIPE_TILE_SIZE 64
+
+// Number of tasks per thread a frame is split into, so that threads finishing
+// early can pick up the tiles of slower ones.
+#define HEAL_TASKS_PER_THREAD 4
+
+// Dead pixel flags packed one bit per pixel, in frame coordinates (bottom-up
+// like RGB frames). The mask is surrounded by a guard border of dead pixels as
+// wide as the neighbor search reaches, so that lookups need no bounds checks.
+class DeadPixelMask {
+  int width;
+  int height;
+  int padded_width;
+  std::vector<uint64_t> bits;
+
+  size_t BitIndex(int x, int y) const {
+    return (size_t)(y + MAX_REPLACEMENT_DISTANCE) * padded_width + (x + MAX_REPLACEMENT_DISTANCE);
+  }
+
+public:
+  DeadPixelMask(int width, int height);
+
+  int GetWidth() const {
+    return width;
+  }
+
+  int GetHeight() const {
+    return height;
+  }
+
+  void SetDead(int x, int y) {
+    size_t i = BitIndex(x, y);
+    bits[i >> 6] |= (uint64_t)1 << (i & 63);
+  }
+
+  // x and y may be up to MAX_REPLACEMENT_DISTANCE outside of the frame, such
+  // pixels are dead by default
+  bool IsDead(int x, int y) const {
+    size_t i = BitIndex(x, y);
+    return ((bits[i >> 6] >> (i & 63)) & 1) != 0;
+  }
+
+  // Returns the first x in [from, end) such that (x, y) is dead, or end.
+  int FindDead(int from, int end, int y) const;
+};
+
+// Describes all dead pixels of a mask in structure-of-arrays form. Only the
+// replacement pixels actually used are stored: those of dead pixel i occupy
+// indices [starts[i], starts[i + 1]) of the replacement arrays. Dead pixels are
+// ordered tile by tile, see RECIPE_TILE_SIZE.
+struct PixelHealRecipes {
+  PixelHealRecipes() {
+    starts.push_back(0);
+  }
+
+  size_t size() const {
+    return frame_x.size();
+  }
+
+  // per dead pixel
+  std::vector<int> frame_x;
+  std::vector<int> frame_y;
+  std::vector<uint32_t> starts;
+
+  // per replacement pixel
+  std::vector<int8_t> offset_x;
+  std::vector<int8_t> offset_y;
+  std::vector<uint16_t> weights; // 0 = 0%, UINT16_MAX = 100%
+};
+
+// Memory layout of one plane of a frame.
+struct PlaneLayout {
+  int width;
+  int height;
+  int pitch;
+  int bytes_per_pixel;
+  bool bottom_up; // RGB frames are stored bottom-up, planar ones top-down
+};
+
+// PixelHealRecipes resolved to byte offsets for one plane layout, so that
+// GetFrame touches nothing but the offsets and weights it needs.
+struct CompiledPixelHealRecipes {
+  CompiledPixelHealRecipes()
+    : gather_limit(0) {
+    memset(&layout, 0, sizeof(layout));
+  }
+
+  void Compile(const PixelHealRecipes& recipes, const PlaneLayout& layout);
+
+  // the layout the offsets were computed for
+  PlaneLayout layout;
+
+  // Largest dead pixel offset whose replacements can all be read as 32-bit
+  // words without running past the end of the plane. Matters for RGB24 and
+  // planar formats only.
+  int gather_limit;
+
+  // 1 for dead pixels the AVX2 kernels heal one byte at a time, because the
+  // 32-bit read of one of their replacements would take in bytes of a dead
+  // pixel of another tile, which may be healed concurrently, or run past the
+  // end of its row. Always 0 for RGB32, where a word is a whole pixel.
+  std::vector<uint8_t> byte_reads;
+
+  // byte offset of each dead pixel from the start of the plane
+  std::vector<int> pixel_offsets;
+
+  // byte offset of each replacement pixel relative to its dead pixel
+  std::vector<int> offsets;
+
+  // dead pixels of tile i are [tile_starts[i], tile_starts[i + 1]), only tiles
+  // containing dead pixels are listed
+  std::vector<size_t> tile_starts;
+};
+
+// Heals dead pixels [begin, end) of a plane, reading the replacements from src
+// and writing the results to dst. Both must have the pitch the recipes were
+// compiled for; they may be the same plane.
+typedef void (*HealPixelsFunc)(
+  const unsigned char* src,
+  unsigned char* dst,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  size_t begin,
+  size_t end
+);
+
+// Returns the heal recipes of all dead pixels of mask, in tile order.
+void GeneratePixelHealRecipes(const DeadPixelMask& mask, PixelHealRecipes& recipes);
+
+// Derives the recipes of a chroma plane of the given size from the recipes of
+// its 2x2 subsampled luma plane.
+void GenerateChromaHealRecipes(const PixelHealRecipes& luma_recipes, int width, int height, PixelHealRecipes& recipes);
+
+// Counts the dead pixels of each row, so that those of row y are at
+// [row_starts[y], row_starts[y + 1]) once sorted by row.
+void GetRowStarts(const PixelHealRecipes& recipes, int height, std::vector<size_t>& row_starts);
+
+// Copies recipes into sorted ordered by row rather than by tile. The dead pixels
+// of row y end up at [row_starts[y], row_starts[y + 1]).
+void SortRecipesByRow(
+  const PixelHealRecipes& recipes,
+  int height,
+  PixelHealRecipes& sorted,
+  std::vector<size_t>& row_starts
+);
+
+// Heals all dead pixels of the plane at ptr, laid out as compiled.layout, in
+// parallel on pool.
+void HealPlaneTiles(
+  unsigned char* ptr,
+  const PixelHealRecipes& recipes,
+  const CompiledPixelHealRecipes& compiled,
+  HealPixelsFunc heal_pixels,
+  ThreadPool& pool
+);
@@ -0,0 +1,109 @@
+// RecipeCache.cpp : Persistent on-disk cache of generated heal recipes.
+//
+
+#include "stdafx.h"
+#include "RecipeCache.h"
+#include "HealRecipes.h"
+
+#include <cstdio>
+
+// Read-only memory mapping of a whole file. GetSize() is 0 if the file could
+// not be mapped.
+class MappedFile {
+  HANDLE file;
+  HANDLE mapping;
+  const unsigned char* view;
+  uint64_t size;
+
+public:
+  explicit MappedFile(const wchar_t* path)
+    : file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL), size(0) {
+    file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+      return;
+    }
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+      return;
+    }
+    view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view != NULL) {
+      size = file_size.QuadPart;
+    }
+  }
+
+  ~MappedFile() {
+    if (view != NULL) {
+      UnmapViewOfFile(view);
+    }
+    if (mapping != NULL) {
+      CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+    }
+  }
+
+  const unsigned char* GetData() const {
+    return view;
+  }
+
+  uint64_t GetSize() const {
+    return size;
+  }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+// 64-bit FNV-1a
+static uint64_t HashBytes(const unsigned char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool GetRecipeCacheKey(const wchar_t* mask_file, const VideoInfo& vi, RecipeCacheKey& key) {
+  MappedFile file(mask_file);
+  if (file.GetSize() == 0) {
+    return false;
+  }
+  key.mask_hash = HashBytes(file.GetData(), (size_t)file.GetSize());
+  key.width = vi.width;
+  key.height = vi.height;
+  return true;
+}
+
+bool LoadRecipeCache(const wchar_t* cache_file, const RecipeCacheKey& key, PixelHealRecipes& recipes) {
+  MappedFile file(cache_file);
+  return ReadRecipeCache(file.GetData(), file.GetSize(), key, recipes);
+}
+
+bool SaveRecipeCache(const wchar_t* cache_file, const RecipeCacheKey& key, const PixelHealRecipes& recipes) {
+  std::vector<unsigned char> data;
+  WriteRecipeCache(key, recipes, data);
+
+  // write a temporary file first so that other processes never map a partial cache
+  std::wstring temp_file = std::wstring(cache_file) + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+  FILE* file;
+  if (_wfopen_s(&file, temp_file.c_str(), L"wb") != 0) {
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = (fclose(file) == 0) && ok;
+
+  if (!ok || !MoveFileExW(temp_file.c_str(), cache_file, MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileW(temp_file.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,15 @@
+// RecipeCache.h : Persistent on-disk cache of generated heal recipes.
+//
+
+#pragma once
+
+#include "RecipeCacheFormat.h"
+
+// Hashes the contents of the mask file. Returns false if it can't be read.
+bool GetRecipeCacheKey(const wchar_t* mask_file, const VideoInfo& vi, RecipeCacheKey& key);
+
+// Maps the cache file and loads the recipes if it matches the key.
+bool LoadRecipeCache(const wchar_t* cache_file, const RecipeCacheKey& key, PixelHealRecipes& recipes);
+
+// Writes the cache file, replacing an existing one atomically.
+bool SaveRecipeCache(const wchar_t* cache_file, const RecipeCacheKey& key, const PixelHealRecipes& recipes);
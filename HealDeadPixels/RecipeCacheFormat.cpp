@@ -0,0 +1,117 @@
+// RecipeCacheFormat.cpp : File layout of the heal recipe cache.
+//
+
+#include "RecipeCacheFormat.h"
+#include "HealRecipes.h"
+
+#include <cstdlib>
+#include <cstring>
+
+static const char RECIPE_CACHE_MAGIC[8] = { 'H', 'D', 'P', 'C', 'A', 'C', 'H', 'E' };
+
+template<typename T>
+static const unsigned char* ReadArray(const unsigned char* ptr, std::vector<T>& array, uint64_t count) {
+  array.resize((size_t)count);
+  if (count > 0) {
+    memcpy(array.data(), ptr, (size_t)count * sizeof(T));
+  }
+  return ptr + count * sizeof(T);
+}
+
+template<typename T>
+static void WriteArray(std::vector<unsigned char>& data, const std::vector<T>& array) {
+  const unsigned char* bytes = (const unsigned char*)array.data();
+  data.insert(data.end(), bytes, bytes + array.size() * sizeof(T));
+}
+
+// Makes sure a loaded cache can't make GetFrame touch memory outside the frame.
+static bool ValidateRecipes(const PixelHealRecipes& recipes, const RecipeCacheKey& key) {
+  if (recipes.starts[0] != 0 || recipes.starts[recipes.size()] != recipes.weights.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < recipes.size(); i++) {
+    int x = recipes.frame_x[i];
+    int y = recipes.frame_y[i];
+    if (x < 0 || x >= key.width || y < 0 || y >= key.height ||
+        recipes.starts[i] > recipes.starts[i + 1] || recipes.starts[i + 1] > recipes.weights.size() ||
+        recipes.starts[i + 1] - recipes.starts[i] > MAX_REPLACEMENT_PIXELS) {
+      return false;
+    }
+    for (uint32_t j = recipes.starts[i]; j < recipes.starts[i + 1]; j++) {
+      int offset_x = recipes.offset_x[j];
+      int offset_y = recipes.offset_y[j];
+      if (abs(offset_x) + abs(offset_y) > MAX_REPLACEMENT_DISTANCE ||
+          x + offset_x < 0 || x + offset_x >= key.width ||
+          y + offset_y < 0 || y + offset_y >= key.height) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool ReadRecipeCache(const unsigned char* data, uint64_t size, const RecipeCacheKey& key, PixelHealRecipes& recipes) {
+  recipes = PixelHealRecipes();
+  if (size < sizeof(RecipeCacheHeader)) {
+    return false;
+  }
+
+  RecipeCacheHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, RECIPE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != RECIPE_CACHE_VERSION ||
+      header.max_replacement_pixels != MAX_REPLACEMENT_PIXELS ||
+      header.max_replacement_distance != MAX_REPLACEMENT_DISTANCE ||
+      header.width != key.width ||
+      header.height != key.height ||
+      header.mask_hash != key.mask_hash) {
+    return false;
+  }
+
+  uint64_t pixel_count = header.pixel_count;
+  uint64_t replacement_count = header.replacement_count;
+  if (pixel_count > (uint64_t)key.width * key.height ||
+      replacement_count > pixel_count * MAX_REPLACEMENT_PIXELS ||
+      size != sizeof(header) +
+        pixel_count * (2 * sizeof(int32_t) + sizeof(uint32_t)) + sizeof(uint32_t) +
+        replacement_count * (sizeof(uint16_t) + 2 * sizeof(int8_t))) {
+    return false;
+  }
+
+  const unsigned char* ptr = data + sizeof(header);
+  ptr = ReadArray(ptr, recipes.frame_x, pixel_count);
+  ptr = ReadArray(ptr, recipes.frame_y, pixel_count);
+  ptr = ReadArray(ptr, recipes.starts, pixel_count + 1);
+  ptr = ReadArray(ptr, recipes.weights, replacement_count);
+  ptr = ReadArray(ptr, recipes.offset_x, replacement_count);
+  ptr = ReadArray(ptr, recipes.offset_y, replacement_count);
+
+  if (!ValidateRecipes(recipes, key)) {
+    recipes = PixelHealRecipes();
+    return false;
+  }
+  return true;
+}
+
+void WriteRecipeCache(const RecipeCacheKey& key, const PixelHealRecipes& recipes, std::vector<unsigned char>& data) {
+  RecipeCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RECIPE_CACHE_MAGIC, sizeof(header.magic));
+  header.version = RECIPE_CACHE_VERSION;
+  header.max_replacement_pixels = MAX_REPLACEMENT_PIXELS;
+  header.max_replacement_distance = MAX_REPLACEMENT_DISTANCE;
+  header.width = key.width;
+  header.height = key.height;
+  header.mask_hash = key.mask_hash;
+  header.pixel_count = recipes.size();
+  header.replacement_count = recipes.weights.size();
+
+  const unsigned char* header_bytes = (const unsigned char*)&header;
+  data.assign(header_bytes, header_bytes + sizeof(header));
+  WriteArray(data, recipes.frame_x);
+  WriteArray(data, recipes.frame_y);
+  WriteArray(data, recipes.starts);
+  WriteArray(data, recipes.weights);
+  WriteArray(data, recipes.offset_x);
+  WriteArray(data, recipes.offset_y);
+}
@@ -0,0 +1,46 @@
+// RecipeCacheFormat.h : File layout of the heal recipe cache.
+//
+// Free of AviSynth and Windows dependencies, see CMakeLists.txt.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct PixelHealRecipes;
+
+// Bump whenever the file layout or the way recipes are generated changes.
+#define RECIPE_CACHE_VERSION 2
+
+// Everything the recipes generated from a mask depend on, apart from the
+// MAX_REPLACEMENT_* constants which are stored in the file as well.
+struct RecipeCacheKey {
+  uint64_t mask_hash;
+  int32_t width;
+  int32_t height;
+};
+
+// The file starts with this header, followed by the arrays frame_x, frame_y
+// (int32 per dead pixel), starts (uint32 per dead pixel plus one), weights
+// (uint16 per replacement), offset_x and offset_y (int8 per replacement), all
+// in native byte order.
+struct RecipeCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t max_replacement_pixels;
+  uint32_t max_replacement_distance;
+  int32_t width;
+  int32_t height;
+  uint32_t reserved;
+  uint64_t mask_hash;
+  uint64_t pixel_count;
+  uint64_t replacement_count;
+};
+
+// Loads the recipes from the size bytes of a cache file at data if the file
+// matches key. Files that don't, or whose recipes could make GetFrame touch
+// memory outside the frame, are rejected, leaving recipes empty.
+bool ReadRecipeCache(const unsigned char* data, uint64_t size, const RecipeCacheKey& key, PixelHealRecipes& recipes);
+
+// Replaces data with the contents of the cache file of recipes.
+void WriteRecipeCache(const RecipeCacheKey& key, const PixelHealRecipes& recipes, std::vector<unsigned char>& data);
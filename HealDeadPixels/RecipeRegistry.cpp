@@ -0,0 +1,115 @@
+// RecipeRegistry.cpp : Process-wide registry of recipe sets shared between filter instances.
+//
+
+#include "stdafx.h"
+#include "RecipeRegistry.h"
+#include "HealRecipes.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
+
+struct RecipeSetKeyLess {
+  bool operator()(const RecipeSetKey& lhs, const RecipeSetKey& rhs) const {
+    return
+      std::tie(lhs.mask_file, lhs.cache_key.mask_hash, lhs.cache_key.width, lhs.cache_key.height, lhs.chroma, lhs.row_order) <
+      std::tie(rhs.mask_file, rhs.cache_key.mask_hash, rhs.cache_key.width, rhs.cache_key.height, rhs.chroma, rhs.row_order);
+  }
+};
+
+struct CompiledKey {
+  RecipeSetKey recipe_set;
+  PlaneLayout layout;
+};
+
+struct CompiledKeyLess {
+  bool operator()(const CompiledKey& lhs, const CompiledKey& rhs) const {
+    if (RecipeSetKeyLess()(lhs.recipe_set, rhs.recipe_set)) {
+      return true;
+    }
+    if (RecipeSetKeyLess()(rhs.recipe_set, lhs.recipe_set)) {
+      return false;
+    }
+    const PlaneLayout& l = lhs.layout;
+    const PlaneLayout& r = rhs.layout;
+    return
+      std::tie(l.width, l.height, l.pitch, l.bytes_per_pixel, l.bottom_up) <
+      std::tie(r.width, r.height, r.pitch, r.bytes_per_pixel, r.bottom_up);
+  }
+};
+
+// Namespace scope rather than function statics, which are not initialized in a
+// thread-safe way by all the compilers we support.
+static std::mutex registry_mutex;
+static std::map<RecipeSetKey, std::weak_ptr<const PixelHealRecipes>, RecipeSetKeyLess> recipe_sets;
+static std::map<CompiledKey, std::weak_ptr<const CompiledPixelHealRecipes>, CompiledKeyLess> compiled_sets;
+
+template<typename Map>
+static void RemoveExpired(Map& map) {
+  for (auto it = map.begin(); it != map.end();) {
+    if (it->second.expired()) {
+      it = map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::shared_ptr<const PixelHealRecipes> FindRecipes(const RecipeSetKey& key) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto it = recipe_sets.find(key);
+  if (it == recipe_sets.end()) {
+    return std::shared_ptr<const PixelHealRecipes>();
+  }
+  return it->second.lock();
+}
+
+std::shared_ptr<const PixelHealRecipes> RegisterRecipes(
+  const RecipeSetKey& key,
+  const std::shared_ptr<const PixelHealRecipes>& recipes
+  ) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::weak_ptr<const PixelHealRecipes>& entry = recipe_sets[key];
+  std::shared_ptr<const PixelHealRecipes> existing = entry.lock();
+  if (existing) {
+    return existing;
+  }
+  entry = recipes;
+  RemoveExpired(recipe_sets);
+  return recipes;
+}
+
+std::shared_ptr<const CompiledPixelHealRecipes> GetCompiledRecipes(
+  const RecipeSetKey& key,
+  const PixelHealRecipes& recipes,
+  const PlaneLayout& layout
+  ) {
+  CompiledKey compiled_key;
+  compiled_key.recipe_set = key;
+  compiled_key.layout = layout;
+
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto it = compiled_sets.find(compiled_key);
+    if (it != compiled_sets.end()) {
+      std::shared_ptr<const CompiledPixelHealRecipes> existing = it->second.lock();
+      if (existing) {
+        return existing;
+      }
+    }
+  }
+
+  // compile without holding the lock, large recipe sets take a while
+  std::shared_ptr<CompiledPixelHealRecipes> compiled = std::make_shared<CompiledPixelHealRecipes>();
+  compiled->Compile(recipes, layout);
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::weak_ptr<const CompiledPixelHealRecipes>& entry = compiled_sets[compiled_key];
+  std::shared_ptr<const CompiledPixelHealRecipes> existing = entry.lock();
+  if (existing) {
+    return existing;
+  }
+  entry = compiled;
+  RemoveExpired(compiled_sets);
+  return compiled;
+}
@@ -0,0 +1,40 @@
+// RecipeRegistry.h : Process-wide registry of recipe sets shared between filter instances.
+//
+// Scripts often use several HealDeadPixels instances with the same mask. The
+// registry hands all of them the same immutable recipes, and the same compiled
+// recipes for a given plane layout. Entries go away with the last instance
+// using them.
+
+#pragma once
+
+#include "RecipeCache.h"
+
+struct PixelHealRecipes;
+struct CompiledPixelHealRecipes;
+struct PlaneLayout;
+
+// Identifies one recipe set: the mask path plus everything the recipes depend on.
+struct RecipeSetKey {
+  std::wstring mask_file;
+  RecipeCacheKey cache_key;
+  bool chroma; // recipes for the 2x2 subsampled chroma planes of YV12
+  bool row_order; // sorted by row rather than by tile, see SortRecipesByRow
+};
+
+// Returns the registered recipes for the key, or an empty pointer.
+std::shared_ptr<const PixelHealRecipes> FindRecipes(const RecipeSetKey& key);
+
+// Registers newly generated recipes. If another instance registered the same
+// key in the meantime, its recipes are returned instead.
+std::shared_ptr<const PixelHealRecipes> RegisterRecipes(
+  const RecipeSetKey& key,
+  const std::shared_ptr<const PixelHealRecipes>& recipes
+);
+
+// Returns the recipes compiled for the plane layout, compiling them if no other
+// instance has done so yet.
+std::shared_ptr<const CompiledPixelHealRecipes> GetCompiledRecipes(
+  const RecipeSetKey& key,
+  const PixelHealRecipes& recipes,
+  const PlaneLayout& layout
+);
@@ -5,7 +5,6 @@
 
 #pragma once
 
-#define _USE_MATH_DEFINES
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 
 #include <windows.h>
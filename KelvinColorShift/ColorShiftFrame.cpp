@@ -0,0 +1,380 @@
+// ColorShiftFrame.cpp : Whole-frame shift and content hash, split into bands of rows.
+//
+
+#include "ColorShiftFrame.h"
+
+#include <algorithm>
+#include <cstring>
+
+int GetBandCount(const ThreadPool& pool, int height) {
+  return std::max(1, std::min(pool.GetThreadCount(), height / MIN_BAND_HEIGHT));
+}
+
+namespace {
+
+// What happens to a pixel, see GetPixelAction.
+enum PixelAction {
+  PIXEL_KEEP,
+  PIXEL_SHIFT,
+  PIXEL_BLEND
+};
+
+// A hard mask shifts the pixels from MASK_THRESHOLD on, a soft mask blends
+// all but those at 0 and 255.
+PixelAction GetPixelAction(unsigned char weight, bool soft_mask) {
+  if (!soft_mask) {
+    return weight >= MASK_THRESHOLD ? PIXEL_SHIFT : PIXEL_KEEP;
+  }
+  return weight == 0 ? PIXEL_KEEP : (weight == UCHAR_MAX ? PIXEL_SHIFT : PIXEL_BLEND);
+}
+
+// Splits the width pixels of a row into runs of pixels with the same action
+// and calls run(action, x, count) for each. Pixels outside [x_begin, x_end)
+// are kept, those inside it shifted without weights. weights holds step
+// bytes per pixel.
+template<typename Run>
+void ForEachRun(
+  int width,
+  int x_begin,
+  int x_end,
+  const unsigned char* weights,
+  int step,
+  bool soft_mask,
+  Run run
+  ) {
+  if (x_begin > 0) {
+    run(PIXEL_KEEP, 0, x_begin);
+  }
+  int x = x_begin;
+  while (x < x_end) {
+    PixelAction action = PIXEL_SHIFT;
+    int run_end = x_end;
+    if (weights != NULL) {
+      action = GetPixelAction(weights[x * step], soft_mask);
+      run_end = x + 1;
+      while (run_end < x_end && GetPixelAction(weights[run_end * step], soft_mask) == action) {
+        run_end++;
+      }
+    }
+    run(action, x, run_end - x);
+    x = run_end;
+  }
+  if (x_end < width) {
+    run(PIXEL_KEEP, x_end, width - x_end);
+  }
+}
+
+// Stores the mask values of pixels [x_begin, x_end) of picture row y (counted
+// from the top) step times each from weights[x * step] on, so that they
+// line up with the bytes of the pixels.
+void ReadMaskRow(const ShiftMask& mask, int y, int x_begin, int x_end, int step, unsigned char* weights) {
+  const unsigned char* row = mask.ptr + (mask.bottom_up ? mask.height - 1 - y : y) * mask.pitch;
+  if (mask.bytes_per_pixel == 1 && step == 1) {
+    memcpy(weights + x_begin, row + x_begin, x_end - x_begin);
+    return;
+  }
+  for (int x = x_begin; x < x_end; x++) {
+    const unsigned char* pixel = row + x * mask.bytes_per_pixel;
+    unsigned char value = (mask.bytes_per_pixel == 1) ? pixel[0] : std::max(pixel[0], std::max(pixel[1], pixel[2]));
+    for (int i = 0; i < step; i++) {
+      weights[x * step + i] = value;
+    }
+  }
+}
+
+// Like ReadMaskRow for chroma row y and chroma pixels [x_begin, x_end), each
+// the average of the 2x2 picture pixels it covers. rows holds two picture
+// rows of width pixels.
+void ReadChromaMaskRow(
+  const ShiftMask& mask,
+  int width,
+  int y,
+  int x_begin,
+  int x_end,
+  unsigned char* weights,
+  unsigned char* rows
+  ) {
+  unsigned char* top = rows;
+  unsigned char* bottom = rows + width;
+  ReadMaskRow(mask, 2 * y, 2 * x_begin, 2 * x_end, 1, top);
+  ReadMaskRow(mask, 2 * y + 1, 2 * x_begin, 2 * x_end, 1, bottom);
+  for (int x = x_begin; x < x_end; x++) {
+    weights[x] = (unsigned char)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) / 4);
+  }
+}
+
+void CopyRows(
+  unsigned char* dstp,
+  int dst_pitch,
+  const unsigned char* srcp,
+  int src_pitch,
+  int row_size,
+  int y_begin,
+  int y_end
+  ) {
+  for (int y = y_begin; y < y_end; y++) {
+    memcpy(dstp + (size_t)y * dst_pitch, srcp + (size_t)y * src_pitch, row_size);
+  }
+}
+
+// Grows row to at least size bytes and returns it, NULL for an empty row.
+unsigned char* GetScratchRow(std::vector<unsigned char>& row, size_t size) {
+  if (row.size() < size) {
+    row.resize(size);
+  }
+  return row.empty() ? NULL : &row[0];
+}
+
+// Grows the bands of scratch to at least count.
+void ReserveScratchBands(ShiftFrameScratch& scratch, int count) {
+  if (scratch.bands.size() < (size_t)count) {
+    scratch.bands.resize(count);
+  }
+}
+
+// Copies the rows [begin, y_begin) and [y_end, end) of a plane, the ones
+// above and below the region of interest.
+void CopyRowsOutside(
+  unsigned char* dstp,
+  int dst_pitch,
+  const unsigned char* srcp,
+  int src_pitch,
+  int row_size,
+  int begin,
+  int end,
+  int y_begin,
+  int y_end
+  ) {
+  CopyRows(dstp, dst_pitch, srcp, src_pitch, row_size, begin, y_begin);
+  CopyRows(dstp, dst_pitch, srcp, src_pitch, row_size, y_end, end);
+}
+
+void ShiftFrameRGB(
+  const ShiftFramePlanes& planes,
+  const ShiftMask* mask,
+  const ColorShiftTables& tables,
+  const ShiftFrameOptions& options,
+  ShiftFrameScratch& scratch,
+  ThreadPool& pool
+  ) {
+  const unsigned char* srcp = planes.src[0];
+  unsigned char* dstp = planes.dst[0];
+  int src_pitch = planes.src_pitch[0];
+  int dst_pitch = planes.dst_pitch[0];
+  int width = options.width;
+  int bytes_per_pixel = options.bytes_per_pixel;
+  int roi_x = options.roi_x;
+  int roi_end_x = options.roi_x + options.roi_width;
+  bool copy_rest = (srcp != dstp);
+
+  // RGB frames are stored bottom-up
+  int roi_begin = options.height - options.roi_y - options.roi_height;
+  int roi_end = options.height - options.roi_y;
+  if (copy_rest) {
+    CopyRowsOutside(dstp, dst_pitch, srcp, src_pitch, planes.row_size[0], 0, options.height, roi_begin, roi_end);
+  }
+
+  int rows = roi_end - roi_begin;
+  int bands = GetBandCount(pool, rows);
+  std::unique_lock<std::mutex> scratch_lock;
+  if (mask) {
+    scratch_lock = std::unique_lock<std::mutex>(scratch.mutex);
+    ReserveScratchBands(scratch, bands);
+  }
+  pool.ParallelFor(bands, [&](int band) {
+    unsigned char* weights = NULL;
+    unsigned char* shifted = NULL;
+    if (mask) {
+      ShiftFrameScratch::Band& band_rows = scratch.bands[band];
+      weights = GetScratchRow(band_rows.weights, (size_t)width * bytes_per_pixel);
+      shifted = GetScratchRow(band_rows.shifted, options.soft_mask ? (size_t)width * bytes_per_pixel : 0);
+    }
+    int y_begin = roi_begin + rows * band / bands;
+    int y_end = roi_begin + rows * (band + 1) / bands;
+    for (int y = y_begin; y < y_end; y++) {
+      const unsigned char* s = &srcp[(size_t)y * src_pitch];
+      unsigned char* d = &dstp[(size_t)y * dst_pitch];
+      if (mask) {
+        ReadMaskRow(*mask, options.height - 1 - y, roi_x, roi_end_x, bytes_per_pixel, weights);
+      }
+      ForEachRun(width, roi_x, roi_end_x, weights, bytes_per_pixel, options.soft_mask,
+        [&](PixelAction action, int x, int count) {
+          int offset = x * bytes_per_pixel;
+          int size = count * bytes_per_pixel;
+          if (action == PIXEL_SHIFT) {
+            options.shift_row(s + offset, d + offset, count, tables);
+          } else if (action == PIXEL_BLEND) {
+            options.shift_row(s + offset, shifted + offset, count, tables);
+            options.blend_row(s + offset, shifted + offset, d + offset, weights + offset, size);
+          } else if (copy_rest) {
+            memcpy(d + offset, s + offset, size);
+          }
+        });
+    }
+  });
+}
+
+void ShiftFrameYV12(
+  const ShiftFramePlanes& planes,
+  const ShiftMask* mask,
+  const ColorShiftTables& tables,
+  const ShiftFrameOptions& options,
+  ShiftFrameScratch& scratch,
+  ThreadPool& pool
+  ) {
+  bool copy_rest = (planes.src[0] != planes.dst[0]);
+  if (copy_rest) {
+    // the luma is not touched but AviSynth can't share one plane between frames
+    CopyRows(planes.dst[0], planes.dst_pitch[0], planes.src[0], planes.src_pitch[0], planes.row_size[0],
+      0, planes.height[0]);
+  }
+
+  const unsigned char* plane_luts[] = {
+    tables.plane_u,
+    tables.plane_v
+  };
+  int stacked_shifts[] = {
+    tables.stacked_shift_u,
+    tables.stacked_shift_v
+  };
+
+  // U and V have the same dimensions, each of them is split into bands
+  int row_size = planes.row_size[1];
+  int height = planes.height[1];
+  if (options.stacked) {
+    // the least significant bytes follow height rows below
+    height /= 2;
+  }
+
+  // the region of interest in chroma samples
+  int roi_begin = options.roi_y / 2;
+  int roi_end = (options.roi_y + options.roi_height) / 2;
+  int x_begin = options.roi_x / 2;
+  int x_end = (options.roi_x + options.roi_width) / 2;
+  if (copy_rest) {
+    for (int p = 1; p < 3; p++) {
+      CopyRowsOutside(planes.dst[p], planes.dst_pitch[p], planes.src[p], planes.src_pitch[p], row_size,
+        0, height, roi_begin, roi_end);
+      if (options.stacked) {
+        CopyRowsOutside(planes.dst[p], planes.dst_pitch[p], planes.src[p], planes.src_pitch[p], row_size,
+          height, 2 * height, height + roi_begin, height + roi_end);
+      }
+    }
+  }
+
+  int rows = roi_end - roi_begin;
+  int bands = GetBandCount(pool, rows);
+  std::unique_lock<std::mutex> scratch_lock;
+  if (mask) {
+    scratch_lock = std::unique_lock<std::mutex>(scratch.mutex);
+    ReserveScratchBands(scratch, 2 * bands);
+  }
+  pool.ParallelFor(2 * bands, [&](int task) {
+    int p = 1 + task / bands;
+    int band = task % bands;
+    int src_pitch = planes.src_pitch[p];
+    int dst_pitch = planes.dst_pitch[p];
+
+    int y_begin = roi_begin + rows * band / bands;
+    int y_end = roi_begin + rows * (band + 1) / bands;
+    const unsigned char* srcp = planes.src[p] + (size_t)y_begin * src_pitch;
+    unsigned char* dstp = planes.dst[p] + (size_t)y_begin * dst_pitch;
+
+    if (options.stacked) {
+      int shift = stacked_shifts[p - 1];
+      size_t src_lsb_offset = (size_t)height * src_pitch;
+      size_t dst_lsb_offset = (size_t)height * dst_pitch;
+      for (int y = y_begin; y < y_end; y++) {
+        const unsigned char* s = srcp;
+        unsigned char* d = dstp;
+        ForEachRun(row_size, x_begin, x_end, NULL, 1, false,
+          [&](PixelAction action, int x, int count) {
+            if (action == PIXEL_SHIFT) {
+              options.shift_stacked_row(s + x, s + src_lsb_offset + x, d + x, d + dst_lsb_offset + x, count, shift);
+            } else if (copy_rest) {
+              memcpy(d + x, s + x, count);
+              memcpy(d + dst_lsb_offset + x, s + src_lsb_offset + x, count);
+            }
+          });
+        srcp += src_pitch;
+        dstp += dst_pitch;
+      }
+      return;
+    }
+
+    const unsigned char* lut = plane_luts[p - 1];
+    unsigned char* weights = NULL;
+    unsigned char* mask_rows = NULL;
+    unsigned char* shifted = NULL;
+    if (mask) {
+      ShiftFrameScratch::Band& band_rows = scratch.bands[task];
+      weights = GetScratchRow(band_rows.weights, row_size);
+      mask_rows = GetScratchRow(band_rows.mask_rows, 2 * (size_t)options.width);
+      shifted = GetScratchRow(band_rows.shifted, options.soft_mask ? row_size : 0);
+    }
+    for (int y = y_begin; y < y_end; y++) {
+      const unsigned char* s = srcp;
+      unsigned char* d = dstp;
+      if (mask) {
+        ReadChromaMaskRow(*mask, options.width, y, x_begin, x_end, weights, mask_rows);
+      }
+      ForEachRun(row_size, x_begin, x_end, weights, 1, options.soft_mask,
+        [&](PixelAction action, int x, int count) {
+          if (action == PIXEL_SHIFT) {
+            ShiftPlaneRow(s + x, d + x, count, lut);
+          } else if (action == PIXEL_BLEND) {
+            ShiftPlaneRow(s + x, shifted + x, count, lut);
+            options.blend_row(s + x, shifted + x, d + x, weights + x, count);
+          } else if (copy_rest) {
+            memcpy(d + x, s + x, count);
+          }
+        });
+      srcp += src_pitch;
+      dstp += dst_pitch;
+    }
+  });
+}
+
+} // namespace
+
+void ShiftFrame(
+  const ShiftFramePlanes& planes,
+  const ShiftMask* mask,
+  const ColorShiftTables& tables,
+  const ShiftFrameOptions& options,
+  ShiftFrameScratch& scratch,
+  ThreadPool& pool
+  ) {
+  if (options.bytes_per_pixel != 0) {
+    ShiftFrameRGB(planes, mask, tables, options, scratch, pool);
+  } else {
+    ShiftFrameYV12(planes, mask, tables, options, scratch, pool);
+  }
+}
+
+void HashPlaneBands(
+  const unsigned char* ptr,
+  int pitch,
+  int row_size,
+  int height,
+  HashStripesFunc hash_stripes,
+  ThreadPool& pool,
+  std::vector<uint64_t>& band_hashes
+  ) {
+  int bands = GetBandCount(pool, height);
+  size_t first = band_hashes.size();
+  band_hashes.resize(first + bands);
+  pool.ParallelFor(bands, [&](int band) {
+    int y_begin = height * band / bands;
+    int y_end = height * (band + 1) / bands;
+    FrameHash hash(hash_stripes);
+    hash.AddPlane(ptr + (size_t)y_begin * pitch, pitch, row_size, y_end - y_begin);
+    band_hashes[first + band] = hash.Finish();
+  });
+}
+
+uint64_t HashBandHashes(const std::vector<uint64_t>& band_hashes, HashStripesFunc hash_stripes) {
+  FrameHash hash(hash_stripes);
+  hash.AddRow((const unsigned char*)band_hashes.data(), (int)(band_hashes.size() * sizeof(uint64_t)));
+  return hash.Finish();
+}
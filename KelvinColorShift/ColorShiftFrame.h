@@ -0,0 +1,111 @@
+// ColorShiftFrame.h : Whole-frame KelvinColorShift -- band splitting, region of
+// interest, masks and per-plane kernel dispatch.
+//
+// Works on plain plane pointers, so that the filter and the benchmarks run the
+// same code without an AviSynth host.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ColorShiftKernels.h"
+#include "FrameHash.h"
+#include "../ThreadPool.h"
+
+// Number of horizontal bands to split height rows into, at most one per thread
+// and none smaller than MIN_BAND_HEIGHT.
+int GetBandCount(const ThreadPool& pool, int height);
+
+// The planes of a source and a destination frame, which may be the same: the
+// only plane of an RGB frame, stored bottom-up, or Y, U and V of a YV12 frame.
+// Stacked planes are twice the height of the picture.
+struct ShiftFramePlanes {
+  const unsigned char* src[3];
+  int src_pitch[3];
+  unsigned char* dst[3];
+  int dst_pitch[3];
+  int row_size[3];
+  int height[3];
+};
+
+// The frame of a mask clip of the same size as the picture: the luma plane of
+// a YUV one or the only plane of an RGB one. The value of an RGB mask pixel is
+// its brightest channel, like the mask bitmaps of HealDeadPixels.
+struct ShiftMask {
+  const unsigned char* ptr;
+  int pitch;
+  int bytes_per_pixel;
+  int height;
+  bool bottom_up;
+};
+
+// How KelvinColorShift shifts the frames of a clip.
+struct ShiftFrameOptions {
+  int width;
+  int height;
+
+  // 3 or 4 for RGB, 0 for YV12
+  int bytes_per_pixel;
+  bool stacked;
+
+  // Part of the picture to shift, in pixels from its top left corner, mod 2
+  // for YV12.
+  int roi_x;
+  int roi_y;
+  int roi_width;
+  int roi_height;
+
+  // A soft mask sets the strength of the shift per pixel, a hard one shifts
+  // the pixels from MASK_THRESHOLD on.
+  bool soft_mask;
+
+  ShiftRowFunc shift_row;
+  ShiftStackedRowFunc shift_stacked_row;
+  BlendRowFunc blend_row;
+};
+
+// Rows each band of ShiftFrame needs with a mask, kept between frames so that
+// they are allocated once. Calls sharing one take turns.
+struct ShiftFrameScratch {
+  struct Band {
+    // per byte mask values, the two picture rows under a chroma row and the
+    // shifted pixels to blend
+    std::vector<unsigned char> weights;
+    std::vector<unsigned char> mask_rows;
+    std::vector<unsigned char> shifted;
+  };
+
+  std::vector<Band> bands;
+  std::mutex mutex;
+};
+
+// Transforms the region of interest, and the pixels of it selected by mask if
+// it is not NULL, from src into dst. With a soft mask the shifted pixels are
+// blended with the source ones in the same pass. Everything else is copied if
+// src and dst are different frames and left alone otherwise. The bands of each
+// plane are processed in parallel, using scratch only with a mask.
+void ShiftFrame(
+  const ShiftFramePlanes& planes,
+  const ShiftMask* mask,
+  const ColorShiftTables& tables,
+  const ShiftFrameOptions& options,
+  ShiftFrameScratch& scratch,
+  ThreadPool& pool
+);
+
+// Hashes the bands of a plane in parallel and appends their hashes to
+// band_hashes. Hashing the band hashes of all planes of a frame in order with
+// HashBandHashes gives the hash of the frame.
+void HashPlaneBands(
+  const unsigned char* ptr,
+  int pitch,
+  int row_size,
+  int height,
+  HashStripesFunc hash_stripes,
+  ThreadPool& pool,
+  std::vector<uint64_t>& band_hashes
+);
+
+uint64_t HashBandHashes(const std::vector<uint64_t>& band_hashes, HashStripesFunc hash_stripes);
@@ -0,0 +1,392 @@
+// ColorShiftKernels.cpp : White balance math, shift lookup tables, scalar and SSE2 row and blend kernels, CPU dispatch.
+//
+
+#include "ColorShiftKernels.h"
+#include "ColorShiftPixelsSSE2.h"
+
+#include "../CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+// Based on http://www.tannerhelland.com/4435/convert-temperature-rgb-algorithm-code/
+RGB48 ComputeWhiteBalance(int temp) {
+  RGB48 white_balance;
+  double temp_fp = (double)temp / 100;
+
+  // red
+  if (temp <= 6680) {
+    white_balance.R = SHRT_MAX;
+  }
+  else {
+    double r_fp = 329.698727446 * pow(temp_fp - 60, -0.1332047592);
+    white_balance.R = (short)(128 * r_fp);
+  }
+
+  // green
+  double g_fp;
+  if (temp <= 6600) {
+    g_fp = 99.4708025861 * log(temp_fp) - 161.1195681661;
+  }
+  else {
+    g_fp = 288.1221695283 * pow(temp_fp - 60, -0.0755148492);
+  }
+  white_balance.G = (short)(128 * g_fp);
+
+  // blue
+  if (temp >= 6540) {
+    white_balance.B = SHRT_MAX;
+  }
+  else if (temp <= 1900) {
+    white_balance.B = 0;
+  }
+  else {
+    double b_fp = 138.5177312231 * log(temp_fp - 10) - 305.0447927307;
+    white_balance.B = (short)(128 * b_fp);
+  }
+
+  return white_balance;
+}
+
+RGB48 ComputeColorShift(int from_temp, int to_temp) {
+  RGB48 old_wb = ComputeWhiteBalance(from_temp);
+  RGB48 new_wb = ComputeWhiteBalance(to_temp);
+  RGB48 rgb_shift = old_wb - new_wb;
+
+  // normalize the shift to preserve luminosity
+  return rgb_shift - rgb_shift.Y();
+}
+
+// Terms of RGB48::Y() for every 8-bit channel value. Their sum has to stay in
+// double precision so that it truncates exactly like RGB48::Y(). They do not
+// depend on the shift and are shared by all tables.
+struct LumaTables {
+  LumaTables() {
+    for (int v = 0; v < 256; v++) {
+      short v16 = (short)(v * 128);
+      r[v] = 0.299 * v16;
+      g[v] = 0.587 * v16;
+      b[v] = 0.114 * v16;
+    }
+  }
+
+  double r[256];
+  double g[256];
+  double b[256];
+};
+
+// initialized when the DLL is loaded, before any filter can run
+static const LumaTables luma_tables;
+
+ColorShiftTables::ColorShiftTables(const RGB48& shift)
+  : shift(shift), stacked_shift_u(shift.U()), stacked_shift_v(shift.V()) {
+  char shift_u = (char)(shift.U() >> 8);
+  char shift_v = (char)(shift.V() >> 8);
+
+  for (int v = 0; v < 256; v++) {
+    plane_u[v] = Helpers::Clamp<short, unsigned char>((short)v + shift_u);
+    plane_v[v] = Helpers::Clamp<short, unsigned char>((short)v + shift_v);
+  }
+}
+
+// Same as RGB48::operator*= followed by RGB48::R8() for one 8-bit channel.
+static inline unsigned char ShiftChannel(unsigned char c, int y, short shift) {
+  int v = (int)c * 128 + (y * shift) / SHRT_MAX;
+  if (v <= 0) {
+    return 0;
+  }
+  return (unsigned char)((v < SHRT_MAX ? v : SHRT_MAX) / 128);
+}
+
+template<int BytesPerPixel>
+static void ShiftRow_C(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  for (int x = 0; x < width; x++) {
+    int y = (int)(luma_tables.r[src[2]] + luma_tables.g[src[1]] + luma_tables.b[src[0]]);
+    unsigned char b = ShiftChannel(src[0], y, tables.shift.B);
+    unsigned char g = ShiftChannel(src[1], y, tables.shift.G);
+    unsigned char r = ShiftChannel(src[2], y, tables.shift.R);
+    dst[0] = b;
+    dst[1] = g;
+    dst[2] = r;
+    if (BytesPerPixel == 4) {
+      dst[3] = src[3];
+    }
+    src += BytesPerPixel;
+    dst += BytesPerPixel;
+  }
+}
+
+void ShiftRowRGB24_C(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  ShiftRow_C<3>(src, dst, width, tables);
+}
+
+void ShiftRowRGB32_C(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  ShiftRow_C<4>(src, dst, width, tables);
+}
+
+// Shifts groups of four pixels from x on while at least four are left and
+// returns where it stopped. Aligned requires src and dst to be 16-byte aligned
+// at x.
+template<bool Aligned>
+static int ShiftRowRGB32Blocks_SSE2(
+  const unsigned char* src,
+  unsigned char* dst,
+  int x,
+  int width,
+  const ColorShiftTables& tables
+  ) {
+  const __m128i shift_r = _mm_set1_epi32((unsigned short)tables.shift.R);
+  const __m128i shift_g = _mm_set1_epi32((unsigned short)tables.shift.G);
+  const __m128i shift_b = _mm_set1_epi32((unsigned short)tables.shift.B);
+
+  for (; x + 4 <= width; x += 4) {
+    const __m128i* s = (const __m128i*)&src[x * 4];
+    __m128i* d = (__m128i*)&dst[x * 4];
+    __m128i px = Aligned ? _mm_load_si128(s) : _mm_loadu_si128(s);
+    __m128i out = ShiftPixelsSSE2(px, shift_r, shift_g, shift_b);
+    if (Aligned) {
+      _mm_store_si128(d, out);
+    } else {
+      _mm_storeu_si128(d, out);
+    }
+  }
+  return x;
+}
+
+void ShiftRowRGB32_SSE2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  // AviSynth aligns its rows, but a region of interest can start anywhere.
+  // Up to three pixels are shifted one by one until dst is aligned, src then
+  // is too when shifting in place or between frames of the same layout.
+  int x = 0;
+  if (((uintptr_t)dst & 3) == 0) {
+    x = std::min(width, (int)((16 - ((uintptr_t)dst & 15)) & 15) / 4);
+    ShiftRowRGB32_C(src, dst, x, tables);
+  }
+  if ((((uintptr_t)&src[x * 4] | (uintptr_t)&dst[x * 4]) & 15) == 0) {
+    x = ShiftRowRGB32Blocks_SSE2<true>(src, dst, x, width, tables);
+  } else {
+    x = ShiftRowRGB32Blocks_SSE2<false>(src, dst, x, width, tables);
+  }
+  ShiftRowRGB32_C(&src[x * 4], &dst[x * 4], width - x, tables);
+}
+
+void ShiftRowRGB24_SSE2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  const __m128i shift_r = _mm_set1_epi32((unsigned short)tables.shift.R);
+  const __m128i shift_g = _mm_set1_epi32((unsigned short)tables.shift.G);
+  const __m128i shift_b = _mm_set1_epi32((unsigned short)tables.shift.B);
+
+  // Each pixel is loaded as a 32-bit word whose fourth byte belongs to the next
+  // pixel. That byte is written back unchanged and then overwritten by the next
+  // store, so we only need one more pixel to follow the group of four.
+  int x = 0;
+  for (; x + 5 <= width; x += 4) {
+    const unsigned char* s = &src[x * 3];
+    unsigned char* d = &dst[x * 3];
+    int p0, p1, p2, p3;
+    memcpy(&p0, s, 4);
+    memcpy(&p1, s + 3, 4);
+    memcpy(&p2, s + 6, 4);
+    memcpy(&p3, s + 9, 4);
+
+    __m128i out = ShiftPixelsSSE2(_mm_setr_epi32(p0, p1, p2, p3), shift_r, shift_g, shift_b);
+    p0 = _mm_cvtsi128_si32(out);
+    p1 = _mm_cvtsi128_si32(_mm_srli_si128(out, 4));
+    p2 = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+    p3 = _mm_cvtsi128_si32(_mm_srli_si128(out, 12));
+    memcpy(d, &p0, 4);
+    memcpy(d + 3, &p1, 4);
+    memcpy(d + 6, &p2, 4);
+    memcpy(d + 9, &p3, 4);
+  }
+  ShiftRowRGB24_C(&src[x * 3], &dst[x * 3], width - x, tables);
+}
+
+ShiftRowFunc GetShiftRowFunc(int bytes_per_pixel, long cpu_flags) {
+  bool rgb32 = (bytes_per_pixel == 4);
+  if (cpu_flags & CPU_FLAG_SSE2) {
+    if (IsAVX2Supported()) {
+      return rgb32 ? ShiftRowRGB32_AVX2 : ShiftRowRGB24_AVX2;
+    }
+    if (!rgb32 && IsSSSE3Supported()) {
+      return ShiftRowRGB24_SSSE3;
+    }
+    return rgb32 ? ShiftRowRGB32_SSE2 : ShiftRowRGB24_SSE2;
+  }
+  return rgb32 ? ShiftRowRGB32_C : ShiftRowRGB24_C;
+}
+
+void ShiftPlaneRow(const unsigned char* src, unsigned char* dst, int width, const unsigned char* lut) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = lut[src[x]];
+  }
+}
+
+void ShiftStackedRow_C(
+  const unsigned char* src_msb,
+  const unsigned char* src_lsb,
+  unsigned char* dst_msb,
+  unsigned char* dst_lsb,
+  int width,
+  int shift
+  ) {
+  for (int x = 0; x < width; x++) {
+    int v = ((int)src_msb[x] << 8 | src_lsb[x]) + shift;
+    v = (v < 0) ? 0 : (v > USHRT_MAX ? USHRT_MAX : v);
+    dst_msb[x] = (unsigned char)(v >> 8);
+    dst_lsb[x] = (unsigned char)v;
+  }
+}
+
+void ShiftStackedRow_SSE2(
+  const unsigned char* src_msb,
+  const unsigned char* src_lsb,
+  unsigned char* dst_msb,
+  unsigned char* dst_lsb,
+  int width,
+  int shift
+  ) {
+  // one of the two is zero, unsigned saturation does the clamping
+  const __m128i add = _mm_set1_epi16((short)(shift > 0 ? shift : 0));
+  const __m128i sub = _mm_set1_epi16((short)(shift < 0 ? -shift : 0));
+  const __m128i low_mask = _mm_set1_epi16(0xFF);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i msb = _mm_loadu_si128((const __m128i*)&src_msb[x]);
+    __m128i lsb = _mm_loadu_si128((const __m128i*)&src_lsb[x]);
+    __m128i lo = _mm_unpacklo_epi8(lsb, msb);
+    __m128i hi = _mm_unpackhi_epi8(lsb, msb);
+    lo = _mm_subs_epu16(_mm_adds_epu16(lo, add), sub);
+    hi = _mm_subs_epu16(_mm_adds_epu16(hi, add), sub);
+
+    _mm_storeu_si128((__m128i*)&dst_msb[x],
+      _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    _mm_storeu_si128((__m128i*)&dst_lsb[x],
+      _mm_packus_epi16(_mm_and_si128(lo, low_mask), _mm_and_si128(hi, low_mask)));
+  }
+  ShiftStackedRow_C(&src_msb[x], &src_lsb[x], &dst_msb[x], &dst_lsb[x], width - x, shift);
+}
+
+ShiftStackedRowFunc GetShiftStackedRowFunc(long cpu_flags) {
+  if (cpu_flags & CPU_FLAG_SSE2) {
+    return ShiftStackedRow_SSE2;
+  }
+  return ShiftStackedRow_C;
+}
+
+void BlendRow_C(
+  const unsigned char* src,
+  const unsigned char* shifted,
+  unsigned char* dst,
+  const unsigned char* weights,
+  int count
+  ) {
+  for (int i = 0; i < count; i++) {
+    // 0..255 to 0..256, so that 255 picks shifted alone
+    int w = weights[i] + (weights[i] >> 7);
+    dst[i] = (unsigned char)((src[i] * (256 - w) + shifted[i] * w + 128) >> 8);
+  }
+}
+
+// Blends sixteen bytes the way BlendRow_C does. Both products and their sum
+// stay below 65536, so unsigned 16-bit lanes are wide enough.
+static inline __m128i BlendSSE2(__m128i src, __m128i shifted, __m128i weights) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(256);
+  const __m128i round = _mm_set1_epi16(128);
+
+  __m128i w_lo = _mm_unpacklo_epi8(weights, zero);
+  __m128i w_hi = _mm_unpackhi_epi8(weights, zero);
+  w_lo = _mm_add_epi16(w_lo, _mm_srli_epi16(w_lo, 7));
+  w_hi = _mm_add_epi16(w_hi, _mm_srli_epi16(w_hi, 7));
+
+  __m128i lo = _mm_add_epi16(
+    _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), _mm_sub_epi16(one, w_lo)),
+    _mm_mullo_epi16(_mm_unpacklo_epi8(shifted, zero), w_lo));
+  __m128i hi = _mm_add_epi16(
+    _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), _mm_sub_epi16(one, w_hi)),
+    _mm_mullo_epi16(_mm_unpackhi_epi8(shifted, zero), w_hi));
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+  return _mm_packus_epi16(lo, hi);
+}
+
+void BlendRow_SSE2(
+  const unsigned char* src,
+  const unsigned char* shifted,
+  unsigned char* dst,
+  const unsigned char* weights,
+  int count
+  ) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)&src[i]);
+    __m128i t = _mm_loadu_si128((const __m128i*)&shifted[i]);
+    __m128i w = _mm_loadu_si128((const __m128i*)&weights[i]);
+    _mm_storeu_si128((__m128i*)&dst[i], BlendSSE2(s, t, w));
+  }
+  BlendRow_C(&src[i], &shifted[i], &dst[i], &weights[i], count - i);
+}
+
+BlendRowFunc GetBlendRowFunc(long cpu_flags) {
+  if (cpu_flags & CPU_FLAG_SSE2) {
+    if (IsAVX2Supported()) {
+      return BlendRow_AVX2;
+    }
+    return BlendRow_SSE2;
+  }
+  return BlendRow_C;
+}
+
+void SumChannels_C(const unsigned char* row, int width, int bytes_per_pixel, uint64_t sums[3]) {
+  int channels = (bytes_per_pixel < 3) ? bytes_per_pixel : 3;
+  for (int x = 0; x < width; x++) {
+    for (int c = 0; c < channels; c++) {
+      sums[c] += row[c];
+    }
+    row += bytes_per_pixel;
+  }
+}
+
+void SumChannels_SSE2(const unsigned char* row, int width, int bytes_per_pixel, uint64_t sums[3]) {
+  // Sixteen pixels span bytes_per_pixel registers. The byte masks pick the
+  // bytes of one channel from each register, psadbw then adds them up.
+  __m128i masks[4][3];
+  for (int j = 0; j < bytes_per_pixel; j++) {
+    for (int c = 0; c < 3; c++) {
+      unsigned char bytes[16];
+      for (int i = 0; i < 16; i++) {
+        bytes[i] = ((16 * j + i) % bytes_per_pixel == c) ? 0xFF : 0;
+      }
+      masks[j][c] = _mm_loadu_si128((const __m128i*)bytes);
+    }
+  }
+
+  __m128i acc[3] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const unsigned char* block = &row[x * bytes_per_pixel];
+    for (int j = 0; j < bytes_per_pixel; j++) {
+      __m128i v = _mm_loadu_si128((const __m128i*)&block[16 * j]);
+      for (int c = 0; c < 3; c++) {
+        acc[c] = _mm_add_epi64(acc[c], _mm_sad_epu8(_mm_and_si128(v, masks[j][c]), _mm_setzero_si128()));
+      }
+    }
+  }
+
+  for (int c = 0; c < 3; c++) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc[c]);
+    sums[c] += lanes[0] + lanes[1];
+  }
+  SumChannels_C(&row[x * bytes_per_pixel], width - x, bytes_per_pixel, sums);
+}
+
+SumChannelsFunc GetSumChannelsFunc(long cpu_flags) {
+  if (cpu_flags & CPU_FLAG_SSE2) {
+    return SumChannels_SSE2;
+  }
+  return SumChannels_C;
+}
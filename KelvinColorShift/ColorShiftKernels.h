@@ -0,0 +1,112 @@
+// ColorShiftKernels.h : Row kernels applying a white balance shift to BGR pixels and YUV planes.
+//
+// Every BGR variant produces output bit-identical to RGB48::operator*= followed by
+// RGB48::ToRGB8, so they can be swapped freely at runtime.
+
+#pragma once
+
+#include <cstdint>
+
+#include "KelvinColorShift.h"
+
+// Returns the color of a black body of the given temperature in Kelvin.
+RGB48 ComputeWhiteBalance(int temp);
+
+// Returns the shift turning light of from_temp into light of to_temp, adjusted
+// so that it preserves luminosity.
+RGB48 ComputeColorShift(int from_temp, int to_temp);
+
+// Lookup tables derived from one white balance shift. They are built once per
+// shift so the pixel loops are left with table lookups and integer math, and
+// are small enough to keep one per color temperature of an animated shift.
+struct ColorShiftTables {
+  ColorShiftTables() {
+  }
+  explicit ColorShiftTables(const RGB48& shift);
+
+  RGB48 shift;
+
+  // Shifted and clamped U and V plane values, indexed by the source value.
+  unsigned char plane_u[256];
+  unsigned char plane_v[256];
+
+  // Offsets added to 16-bit U and V samples. plane_u and plane_v apply the
+  // same offsets scaled down to 8 bits.
+  int stacked_shift_u;
+  int stacked_shift_v;
+};
+
+// Transforms width pixels from src into dst. src and dst may be the same row.
+typedef void (*ShiftRowFunc)(
+  const unsigned char* src,
+  unsigned char* dst,
+  int width,
+  const ColorShiftTables& tables
+);
+
+void ShiftRowRGB24_C(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB32_C(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB24_SSE2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB32_SSE2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB24_SSSE3(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB24_AVX2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+void ShiftRowRGB32_AVX2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables);
+
+// Picks the fastest row kernel for the given pixel size and CPUF_* flags.
+ShiftRowFunc GetShiftRowFunc(int bytes_per_pixel, long cpu_flags);
+
+// Maps width 8-bit U or V samples through lut (ColorShiftTables::plane_u or
+// plane_v). src and dst may be the same row.
+void ShiftPlaneRow(const unsigned char* src, unsigned char* dst, int width, const unsigned char* lut);
+
+// Adds shift to width 16-bit samples stored as separate rows of most and least
+// significant bytes (the stacked layout), saturating to [0, 65535]. shift must
+// be within [-65535, 65535]. The source and destination rows may be the same.
+typedef void (*ShiftStackedRowFunc)(
+  const unsigned char* src_msb,
+  const unsigned char* src_lsb,
+  unsigned char* dst_msb,
+  unsigned char* dst_lsb,
+  int width,
+  int shift
+);
+
+void ShiftStackedRow_C(const unsigned char* src_msb, const unsigned char* src_lsb, unsigned char* dst_msb, unsigned char* dst_lsb, int width, int shift);
+void ShiftStackedRow_SSE2(const unsigned char* src_msb, const unsigned char* src_lsb, unsigned char* dst_msb, unsigned char* dst_lsb, int width, int shift);
+
+// Picks the fastest stacked row kernel for the given CPUF_* flags.
+ShiftStackedRowFunc GetShiftStackedRowFunc(long cpu_flags);
+
+// Blends count bytes of src and shifted into dst, weighting shifted by
+// weights[i] / 255 in 8-bit fixed point: 0 gives src and 255 shifted exactly.
+// dst may be the same row as src or shifted.
+typedef void (*BlendRowFunc)(
+  const unsigned char* src,
+  const unsigned char* shifted,
+  unsigned char* dst,
+  const unsigned char* weights,
+  int count
+);
+
+void BlendRow_C(const unsigned char* src, const unsigned char* shifted, unsigned char* dst, const unsigned char* weights, int count);
+void BlendRow_SSE2(const unsigned char* src, const unsigned char* shifted, unsigned char* dst, const unsigned char* weights, int count);
+void BlendRow_AVX2(const unsigned char* src, const unsigned char* shifted, unsigned char* dst, const unsigned char* weights, int count);
+
+// Picks the fastest blend kernel for the given CPUF_* flags.
+BlendRowFunc GetBlendRowFunc(long cpu_flags);
+
+// Adds the sums of the first three bytes of width pixels of bytes_per_pixel
+// (1, 3 or 4) bytes each to sums. For BGR pixels these are the channel sums,
+// for single-byte planar samples only sums[0] changes.
+typedef void (*SumChannelsFunc)(
+  const unsigned char* row,
+  int width,
+  int bytes_per_pixel,
+  uint64_t sums[3]
+);
+
+void SumChannels_C(const unsigned char* row, int width, int bytes_per_pixel, uint64_t sums[3]);
+void SumChannels_SSE2(const unsigned char* row, int width, int bytes_per_pixel, uint64_t sums[3]);
+
+// Picks the fastest channel sum kernel for the given CPUF_* flags.
+SumChannelsFunc GetSumChannelsFunc(long cpu_flags);
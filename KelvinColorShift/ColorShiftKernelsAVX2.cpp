@@ -0,0 +1,172 @@
+// ColorShiftKernelsAVX2.cpp : AVX2 white balance row and blend kernels.
+//
+// Only called after IsAVX2Supported() returned true.
+
+#include "ColorShiftKernels.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+
+// Computes RGB48::Y() for eight pixels, see LumaSSE2.
+static inline __m256i LumaAVX2(__m256i r, __m256i g, __m256i b) {
+  const __m256d kr = _mm256_set1_pd(0.299);
+  const __m256d kg = _mm256_set1_pd(0.587);
+  const __m256d kb = _mm256_set1_pd(0.114);
+
+  __m256d lo = _mm256_add_pd(
+    _mm256_add_pd(
+      _mm256_mul_pd(kr, _mm256_cvtepi32_pd(_mm256_castsi256_si128(r))),
+      _mm256_mul_pd(kg, _mm256_cvtepi32_pd(_mm256_castsi256_si128(g)))),
+    _mm256_mul_pd(kb, _mm256_cvtepi32_pd(_mm256_castsi256_si128(b))));
+  __m256d hi = _mm256_add_pd(
+    _mm256_add_pd(
+      _mm256_mul_pd(kr, _mm256_cvtepi32_pd(_mm256_extracti128_si256(r, 1))),
+      _mm256_mul_pd(kg, _mm256_cvtepi32_pd(_mm256_extracti128_si256(g, 1)))),
+    _mm256_mul_pd(kb, _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1))));
+
+  return _mm256_inserti128_si256(
+    _mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)), _mm256_cvttpd_epi32(hi), 1);
+}
+
+// See ShiftChannelSSE2.
+static inline __m256i ShiftChannelAVX2(__m256i c, __m256i y, __m256i shift) {
+  __m256i n = _mm256_madd_epi16(y, shift);
+  __m256i a = _mm256_abs_epi32(n);
+  __m256i q = _mm256_srli_epi32(
+    _mm256_add_epi32(_mm256_add_epi32(a, _mm256_srli_epi32(a, 15)), _mm256_set1_epi32(1)), 15);
+  q = _mm256_sign_epi32(q, n);
+
+  __m256i v = _mm256_add_epi32(c, q);
+  v = _mm256_max_epi32(_mm256_min_epi32(v, _mm256_set1_epi32(SHRT_MAX)), _mm256_setzero_si256());
+  return _mm256_srli_epi32(v, 7);
+}
+
+// See ShiftPixelsSSE2.
+static inline __m256i ShiftPixelsAVX2(__m256i px, __m256i shift_r, __m256i shift_g, __m256i shift_b) {
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+  __m256i b = _mm256_slli_epi32(_mm256_and_si256(px, mask), 7);
+  __m256i g = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask), 7);
+  __m256i r = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask), 7);
+  __m256i y = LumaAVX2(r, g, b);
+
+  __m256i out = _mm256_and_si256(px, _mm256_set1_epi32((int)0xFF000000));
+  out = _mm256_or_si256(out, ShiftChannelAVX2(b, y, shift_b));
+  out = _mm256_or_si256(out, _mm256_slli_epi32(ShiftChannelAVX2(g, y, shift_g), 8));
+  out = _mm256_or_si256(out, _mm256_slli_epi32(ShiftChannelAVX2(r, y, shift_r), 16));
+  return out;
+}
+
+// See ShiftRowRGB32Blocks_SSE2.
+template<bool Aligned>
+static int ShiftRowRGB32Blocks_AVX2(
+  const unsigned char* src,
+  unsigned char* dst,
+  int x,
+  int width,
+  const ColorShiftTables& tables
+  ) {
+  const __m256i shift_r = _mm256_set1_epi32((unsigned short)tables.shift.R);
+  const __m256i shift_g = _mm256_set1_epi32((unsigned short)tables.shift.G);
+  const __m256i shift_b = _mm256_set1_epi32((unsigned short)tables.shift.B);
+
+  for (; x + 8 <= width; x += 8) {
+    const __m256i* s = (const __m256i*)&src[x * 4];
+    __m256i* d = (__m256i*)&dst[x * 4];
+    __m256i px = Aligned ? _mm256_load_si256(s) : _mm256_loadu_si256(s);
+    __m256i out = ShiftPixelsAVX2(px, shift_r, shift_g, shift_b);
+    if (Aligned) {
+      _mm256_store_si256(d, out);
+    } else {
+      _mm256_storeu_si256(d, out);
+    }
+  }
+  return x;
+}
+
+void ShiftRowRGB32_AVX2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  // like ShiftRowRGB32_SSE2, but AviSynth only guarantees 16-byte aligned rows,
+  // so there may be up to seven pixels before a 32-byte boundary
+  int x = 0;
+  if (((uintptr_t)dst & 3) == 0) {
+    x = std::min(width, (int)((32 - ((uintptr_t)dst & 31)) & 31) / 4);
+    ShiftRowRGB32_SSE2(src, dst, x, tables);
+  }
+  if ((((uintptr_t)&src[x * 4] | (uintptr_t)&dst[x * 4]) & 31) == 0) {
+    x = ShiftRowRGB32Blocks_AVX2<true>(src, dst, x, width, tables);
+  } else {
+    x = ShiftRowRGB32Blocks_AVX2<false>(src, dst, x, width, tables);
+  }
+  ShiftRowRGB32_SSE2(&src[x * 4], &dst[x * 4], width - x, tables);
+}
+
+void ShiftRowRGB24_AVX2(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  const __m256i shift_r = _mm256_set1_epi32((unsigned short)tables.shift.R);
+  const __m256i shift_g = _mm256_set1_epi32((unsigned short)tables.shift.G);
+  const __m256i shift_b = _mm256_set1_epi32((unsigned short)tables.shift.B);
+
+  // the shuffles of ShiftRowRGB24_SSSE3 in each 128-bit lane
+  const __m256i spread = _mm256_setr_epi8(
+    0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+    0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i pack = _mm256_setr_epi8(
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i tail = _mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1);
+
+  // Pixels 0-3 go to the low lane and 4-7 to the high one. The low lane is
+  // stored first, its last four bytes are then overwritten by the high lane,
+  // which ends with four bytes unchanged from the source like in the SSSE3
+  // kernel. Loads and stores reach 28 bytes past x * 3.
+  int x = 0;
+  for (; x + 10 <= width; x += 8) {
+    const unsigned char* s = &src[x * 3];
+    unsigned char* d = &dst[x * 3];
+    __m256i in = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)s)),
+      _mm_loadu_si128((const __m128i*)(s + 12)), 1);
+    __m256i out = ShiftPixelsAVX2(_mm256_shuffle_epi8(in, spread), shift_r, shift_g, shift_b);
+    out = _mm256_or_si256(_mm256_shuffle_epi8(out, pack), _mm256_and_si256(in, tail));
+    _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(out));
+    _mm_storeu_si128((__m128i*)(d + 12), _mm256_extracti128_si256(out, 1));
+  }
+  // every CPU with AVX2 has SSSE3
+  ShiftRowRGB24_SSSE3(&src[x * 3], &dst[x * 3], width - x, tables);
+}
+
+void BlendRow_AVX2(
+  const unsigned char* src,
+  const unsigned char* shifted,
+  unsigned char* dst,
+  const unsigned char* weights,
+  int count
+  ) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi16(256);
+  const __m256i round = _mm256_set1_epi16(128);
+
+  // see BlendSSE2; unpack and pack both work within 128-bit lanes, so the
+  // bytes come out in order
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)&src[i]);
+    __m256i t = _mm256_loadu_si256((const __m256i*)&shifted[i]);
+    __m256i w = _mm256_loadu_si256((const __m256i*)&weights[i]);
+
+    __m256i w_lo = _mm256_unpacklo_epi8(w, zero);
+    __m256i w_hi = _mm256_unpackhi_epi8(w, zero);
+    w_lo = _mm256_add_epi16(w_lo, _mm256_srli_epi16(w_lo, 7));
+    w_hi = _mm256_add_epi16(w_hi, _mm256_srli_epi16(w_hi, 7));
+
+    __m256i lo = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), _mm256_sub_epi16(one, w_lo)),
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(t, zero), w_lo));
+    __m256i hi = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), _mm256_sub_epi16(one, w_hi)),
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(t, zero), w_hi));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+    _mm256_storeu_si256((__m256i*)&dst[i], _mm256_packus_epi16(lo, hi));
+  }
+  BlendRow_SSE2(&src[i], &shifted[i], &dst[i], &weights[i], count - i);
+}
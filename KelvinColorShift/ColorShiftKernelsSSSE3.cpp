@@ -0,0 +1,32 @@
+// ColorShiftKernelsSSSE3.cpp : SSSE3 white balance row kernel for RGB24.
+//
+// Only called after IsSSSE3Supported() returned true.
+
+#include "ColorShiftKernels.h"
+#include "ColorShiftPixelsSSE2.h"
+
+#include <immintrin.h>
+
+void ShiftRowRGB24_SSSE3(const unsigned char* src, unsigned char* dst, int width, const ColorShiftTables& tables) {
+  const __m128i shift_r = _mm_set1_epi32((unsigned short)tables.shift.R);
+  const __m128i shift_g = _mm_set1_epi32((unsigned short)tables.shift.G);
+  const __m128i shift_b = _mm_set1_epi32((unsigned short)tables.shift.B);
+
+  // spreads the first four BGR pixels of sixteen bytes over 32-bit lanes and
+  // packs them back into twelve bytes
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m128i tail = _mm_setr_epi32(0, 0, 0, -1);
+
+  // Every store writes sixteen bytes, the last four of them unchanged from the
+  // source. The next store overwrites them, so two more pixels have to follow
+  // the group of four.
+  int x = 0;
+  for (; x + 6 <= width; x += 4) {
+    __m128i in = _mm_loadu_si128((const __m128i*)&src[x * 3]);
+    __m128i out = ShiftPixelsSSE2(_mm_shuffle_epi8(in, spread), shift_r, shift_g, shift_b);
+    out = _mm_or_si128(_mm_shuffle_epi8(out, pack), _mm_and_si128(in, tail));
+    _mm_storeu_si128((__m128i*)&dst[x * 3], out);
+  }
+  ShiftRowRGB24_SSE2(&src[x * 3], &dst[x * 3], width - x, tables);
+}
@@ -0,0 +1,66 @@
+// ColorShiftPixelsSSE2.h : SSE2 helpers shifting four BGRx pixels at a time.
+//
+// Shared by the SSE2 and SSSE3 row kernels, which only differ in how they
+// get pixels into and out of 32-bit lanes. The helpers are static so that
+// each kernel file keeps the copy compiled with its own instruction set.
+
+#pragma once
+
+#include <climits>
+#include <immintrin.h>
+
+// Computes RGB48::Y() for four pixels. The luma has to be evaluated in double
+// precision with the exact same operation order, otherwise the truncation to
+// short would differ from the scalar path for some inputs.
+static inline __m128i LumaSSE2(__m128i r, __m128i g, __m128i b) {
+  const __m128d kr = _mm_set1_pd(0.299);
+  const __m128d kg = _mm_set1_pd(0.587);
+  const __m128d kb = _mm_set1_pd(0.114);
+
+  __m128d lo = _mm_add_pd(
+    _mm_add_pd(_mm_mul_pd(kr, _mm_cvtepi32_pd(r)), _mm_mul_pd(kg, _mm_cvtepi32_pd(g))),
+    _mm_mul_pd(kb, _mm_cvtepi32_pd(b)));
+  r = _mm_shuffle_epi32(r, _MM_SHUFFLE(1, 0, 3, 2));
+  g = _mm_shuffle_epi32(g, _MM_SHUFFLE(1, 0, 3, 2));
+  b = _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2));
+  __m128d hi = _mm_add_pd(
+    _mm_add_pd(_mm_mul_pd(kr, _mm_cvtepi32_pd(r)), _mm_mul_pd(kg, _mm_cvtepi32_pd(g))),
+    _mm_mul_pd(kb, _mm_cvtepi32_pd(b)));
+
+  return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+// Computes c + (y * shift) / SHRT_MAX, clamps it like RGB48::operator+ and
+// scales it back to 8 bits like RGB48::R8(). All lanes are 32-bit; y and shift
+// only occupy the low 16 bits of their lanes.
+static inline __m128i ShiftChannelSSE2(__m128i c, __m128i y, __m128i shift) {
+  __m128i n = _mm_madd_epi16(y, shift);
+
+  // truncating division by SHRT_MAX, floor(a / 32767) == (a + (a >> 15) + 1) >> 15
+  // holds for all 0 <= a < 2^30 which covers every y * shift product
+  __m128i sign = _mm_srai_epi32(n, 31);
+  __m128i a = _mm_sub_epi32(_mm_xor_si128(n, sign), sign);
+  __m128i q = _mm_srli_epi32(
+    _mm_add_epi32(_mm_add_epi32(a, _mm_srli_epi32(a, 15)), _mm_set1_epi32(1)), 15);
+  q = _mm_sub_epi32(_mm_xor_si128(q, sign), sign);
+
+  __m128i v = _mm_packs_epi32(_mm_add_epi32(c, q), _mm_setzero_si128());
+  v = _mm_srli_epi16(_mm_max_epi16(v, _mm_setzero_si128()), 7);
+  return _mm_unpacklo_epi16(v, _mm_setzero_si128());
+}
+
+// Shifts four BGRx pixels held in 32-bit lanes. The fourth byte of each lane is
+// passed through untouched.
+static inline __m128i ShiftPixelsSSE2(__m128i px, __m128i shift_r, __m128i shift_g, __m128i shift_b) {
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  __m128i b = _mm_slli_epi32(_mm_and_si128(px, mask), 7);
+  __m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 8), mask), 7);
+  __m128i r = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(px, 16), mask), 7);
+  __m128i y = LumaSSE2(r, g, b);
+
+  __m128i out = _mm_and_si128(px, _mm_set1_epi32((int)0xFF000000));
+  out = _mm_or_si128(out, ShiftChannelSSE2(b, y, shift_b));
+  out = _mm_or_si128(out, _mm_slli_epi32(ShiftChannelSSE2(g, y, shift_g), 8));
+  out = _mm_or_si128(out, _mm_slli_epi32(ShiftChannelSSE2(r, y, shift_r), 16));
+  return out;
+}
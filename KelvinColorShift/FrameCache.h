@@ -0,0 +1,78 @@
+// FrameCache.h : Least recently used cache of processed frames.
+//
+// Frames are held by reference (PVideoFrame in the filter), so a hit hands
+// out the frame produced earlier without copying it. The capacity bounds the
+// total size of the cached frames in bytes.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+
+// Identifies the result of shifting a frame: the hash of its contents (and
+// those of the mask frame) and the target temperature.
+struct FrameCacheKey {
+  uint64_t hash;
+  int temp;
+
+  bool operator<(const FrameCacheKey& rhs) const {
+    return hash < rhs.hash || (hash == rhs.hash && temp < rhs.temp);
+  }
+};
+
+template<typename Frame>
+class FrameCache {
+  struct Entry {
+    FrameCacheKey key;
+    Frame frame;
+    size_t bytes;
+  };
+
+  // most recently used first
+  std::list<Entry> entries;
+  std::map<FrameCacheKey, typename std::list<Entry>::iterator> index;
+  size_t capacity;
+  size_t size;
+  std::mutex mutex;
+
+public:
+  explicit FrameCache(size_t capacity) : capacity(capacity), size(0) {
+  }
+
+  // Returns true and the cached frame in frame if key is cached.
+  bool Lookup(const FrameCacheKey& key, Frame& frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+      return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    frame = it->second->frame;
+    return true;
+  }
+
+  // Caches frame, which takes bytes of memory, evicting the least recently
+  // used frames to make room. Frames larger than the capacity are not cached.
+  void Insert(const FrameCacheKey& key, const Frame& frame, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bytes > capacity) {
+      return;
+    }
+    if (index.find(key) != index.end()) {
+      // another thread shifted the same frame at the same time
+      return;
+    }
+    while (size + bytes > capacity) {
+      size -= entries.back().bytes;
+      index.erase(entries.back().key);
+      entries.pop_back();
+    }
+    Entry entry = { key, frame, bytes };
+    entries.push_front(entry);
+    index[key] = entries.begin();
+    size += bytes;
+  }
+};
@@ -0,0 +1,127 @@
+// FrameHash.cpp : Frame content hash, scalar and SSE2 stripe kernels, CPU dispatch.
+//
+
+#include "FrameHash.h"
+
+#include "../CpuFeatures.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+// from the XXH3 default secret
+const uint64_t FRAME_HASH_SECRET[FRAME_HASH_BLOCK_STRIPES + 3] = {
+  0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+  0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+  0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+  0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+  0xc3ebd33483acc5eaULL, 0xeb6313faffa081c5ULL, 0x49daf0b751dd0d17ULL
+};
+static const uint64_t SCRAMBLE_KEYS[4] = {
+  0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL
+};
+
+static const uint64_t PRIME32_1 = 0x9E3779B1ULL;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+
+static inline uint64_t Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+void HashStripes_C(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]) {
+  for (size_t s = 0; s < stripes; s++) {
+    for (int i = 0; i < 4; i++) {
+      uint64_t word;
+      memcpy(&word, data + 8 * i, 8);
+      uint64_t keyed = word ^ keys[s + i];
+      lanes[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32) + word;
+    }
+    data += 32;
+  }
+}
+
+void HashStripes_SSE2(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]) {
+  __m128i acc0 = _mm_loadu_si128((const __m128i*)&lanes[0]);
+  __m128i acc1 = _mm_loadu_si128((const __m128i*)&lanes[2]);
+
+  // pmuludq multiplies the low halves of the 64-bit lanes
+  for (size_t s = 0; s < stripes; s++) {
+    __m128i word0 = _mm_loadu_si128((const __m128i*)data);
+    __m128i word1 = _mm_loadu_si128((const __m128i*)(data + 16));
+    __m128i key0 = _mm_loadu_si128((const __m128i*)&keys[s]);
+    __m128i key1 = _mm_loadu_si128((const __m128i*)&keys[s + 2]);
+    __m128i keyed0 = _mm_xor_si128(word0, key0);
+    __m128i keyed1 = _mm_xor_si128(word1, key1);
+    acc0 = _mm_add_epi64(acc0, _mm_add_epi64(_mm_mul_epu32(keyed0, _mm_srli_epi64(keyed0, 32)), word0));
+    acc1 = _mm_add_epi64(acc1, _mm_add_epi64(_mm_mul_epu32(keyed1, _mm_srli_epi64(keyed1, 32)), word1));
+    data += 32;
+  }
+
+  _mm_storeu_si128((__m128i*)&lanes[0], acc0);
+  _mm_storeu_si128((__m128i*)&lanes[2], acc1);
+}
+
+HashStripesFunc GetHashStripesFunc(long cpu_flags) {
+  if (cpu_flags & CPU_FLAG_SSE2) {
+    if (IsAVX2Supported()) {
+      return HashStripes_AVX2;
+    }
+    return HashStripes_SSE2;
+  }
+  return HashStripes_C;
+}
+
+FrameHash::FrameHash(HashStripesFunc hash_stripes) : hash_stripes(hash_stripes), length(0) {
+  lanes[0] = PRIME32_1;
+  lanes[1] = PRIME64_1;
+  lanes[2] = PRIME64_2;
+  lanes[3] = PRIME64_3;
+}
+
+void FrameHash::ScrambleLanes() {
+  for (int i = 0; i < 4; i++) {
+    lanes[i] = (lanes[i] ^ (lanes[i] >> 47) ^ SCRAMBLE_KEYS[i]) * PRIME32_1;
+  }
+}
+
+void FrameHash::AddRow(const unsigned char* row, int size) {
+  size_t stripes = (size_t)size / 32;
+  size_t s = 0;
+  for (; s + FRAME_HASH_BLOCK_STRIPES <= stripes; s += FRAME_HASH_BLOCK_STRIPES) {
+    hash_stripes(row + s * 32, FRAME_HASH_BLOCK_STRIPES, FRAME_HASH_SECRET, lanes);
+    ScrambleLanes();
+  }
+
+  // the rest of the row is shorter than a block, including the padded stripe
+  size_t rest = stripes - s;
+  hash_stripes(row + s * 32, rest, FRAME_HASH_SECRET, lanes);
+  int tail = size % 32;
+  if (tail != 0) {
+    unsigned char padded[32] = {};
+    memcpy(padded, row + stripes * 32, tail);
+    hash_stripes(padded, 1, FRAME_HASH_SECRET + rest, lanes);
+  }
+
+  ScrambleLanes();
+  length += size;
+}
+
+void FrameHash::AddPlane(const unsigned char* ptr, int pitch, int row_size, int height) {
+  for (int y = 0; y < height; y++) {
+    AddRow(ptr + (size_t)y * pitch, row_size);
+  }
+}
+
+uint64_t FrameHash::Finish() const {
+  uint64_t h = length * PRIME64_1;
+  for (int i = 0; i < 4; i++) {
+    h = (h ^ Avalanche(lanes[i])) * PRIME64_1;
+  }
+  return Avalanche(h);
+}
@@ -0,0 +1,51 @@
+// FrameHash.h : Fast 64-bit content hash of frames, in the spirit of XXH3.
+//
+// Rows are consumed in 32-byte stripes by four 64-bit lanes. Each lane adds
+// the product of the two 32-bit halves of its word xored with a key, plus the
+// word itself. As in XXH3, the keys slide along a secret by one word per
+// stripe and the lanes are scrambled after every block of stripes and at the
+// end of every row, so that the same stripes in another order hash
+// differently. The C, SSE2 and AVX2 stripe kernels produce the same lanes, so
+// a hash does not depend on the CPU. Not meant to resist deliberately crafted
+// collisions.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Stripes per block, each keyed with the secret one word further on.
+#define FRAME_HASH_BLOCK_STRIPES 16
+
+// The keys of the stripes of a block: stripe s xors its words with
+// FRAME_HASH_SECRET[s] to FRAME_HASH_SECRET[s + 3].
+extern const uint64_t FRAME_HASH_SECRET[FRAME_HASH_BLOCK_STRIPES + 3];
+
+// Adds stripes 32-byte stripes from data to the four lanes, stripe s keyed
+// with keys[s] to keys[s + 3], all of them within FRAME_HASH_SECRET.
+typedef void (*HashStripesFunc)(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]);
+
+void HashStripes_C(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]);
+void HashStripes_SSE2(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]);
+void HashStripes_AVX2(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]);
+
+// Picks the fastest stripe kernel for the given CPUF_* flags.
+HashStripesFunc GetHashStripesFunc(long cpu_flags);
+
+class FrameHash {
+  HashStripesFunc hash_stripes;
+  uint64_t lanes[4];
+  uint64_t length;
+
+  void ScrambleLanes();
+
+public:
+  explicit FrameHash(HashStripesFunc hash_stripes);
+
+  // Adds size bytes. The last partial stripe of a row is padded with zeros.
+  void AddRow(const unsigned char* row, int size);
+
+  void AddPlane(const unsigned char* ptr, int pitch, int row_size, int height);
+
+  uint64_t Finish() const;
+};
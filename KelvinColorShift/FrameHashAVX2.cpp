@@ -0,0 +1,32 @@
+// FrameHashAVX2.cpp : AVX2 frame hash stripe kernel.
+//
+// Only called after IsAVX2Supported() returned true.
+
+#include "FrameHash.h"
+
+#include <immintrin.h>
+
+void HashStripes_AVX2(const unsigned char* data, size_t stripes, const uint64_t* keys, uint64_t lanes[4]) {
+  __m256i acc = _mm256_loadu_si256((const __m256i*)lanes);
+
+  // see HashStripes_SSE2, two independent accumulators hide the latency of
+  // vpmuludq and are added up at the end
+  __m256i acc2 = _mm256_setzero_si256();
+  size_t s = 0;
+  for (; s + 2 <= stripes; s += 2) {
+    __m256i word = _mm256_loadu_si256((const __m256i*)data);
+    __m256i word2 = _mm256_loadu_si256((const __m256i*)(data + 32));
+    __m256i keyed = _mm256_xor_si256(word, _mm256_loadu_si256((const __m256i*)&keys[s]));
+    __m256i keyed2 = _mm256_xor_si256(word2, _mm256_loadu_si256((const __m256i*)&keys[s + 1]));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32)), word));
+    acc2 = _mm256_add_epi64(acc2, _mm256_add_epi64(_mm256_mul_epu32(keyed2, _mm256_srli_epi64(keyed2, 32)), word2));
+    data += 64;
+  }
+  if (s < stripes) {
+    __m256i word = _mm256_loadu_si256((const __m256i*)data);
+    __m256i keyed = _mm256_xor_si256(word, _mm256_loadu_si256((const __m256i*)&keys[s]));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32)), word));
+  }
+
+  _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc, acc2));
+}
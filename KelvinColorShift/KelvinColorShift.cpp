@@ -2,124 +2,507 @@
 //
 
 #include "stdafx.h"
-#include "KelvinColorShift.h"
+#include "ColorShiftFrame.h"
+#include "ColorShiftKernels.h"
+#include "FrameCache.h"
+#include "FrameHash.h"
+#include "..\CpuFeatures.h"
+#include "..\FilterStats.h"
+#include "..\ThreadPool.h"
+
+// the kernel dispatchers are passed env->GetCPUFlags()
+C_ASSERT(CPU_FLAG_SSE2 == CPUF_SSE2);
+
+// Target color temperature from a frame on, see ParseKeyframes.
+struct TemperatureKeyframe {
+  int frame;
+  int temp;
+};
+
+// Parses "frame:temp" pairs separated by spaces or commas.
+static bool ParseKeyframes(const char* str, std::vector<TemperatureKeyframe>& keyframes) {
+  const char* p = str;
+  for (;;) {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    if (*p == 0) {
+      return !keyframes.empty();
+    }
+
+    char* end;
+    TemperatureKeyframe keyframe;
+    keyframe.frame = (int)strtol(p, &end, 10);
+    if (end == p || *end != ':') {
+      return false;
+    }
+    p = end + 1;
+    keyframe.temp = (int)strtol(p, &end, 10);
+    if (end == p) {
+      return false;
+    }
+    p = end;
+    keyframes.push_back(keyframe);
+  }
+}
 
 class KelvinColorShift : public GenericVideoFilter {
-  RGB48 rgb_shift;
+  int from_temp;
+
+  // to_temp over time, sorted by frame; a single keyframe for a constant shift
+  std::vector<TemperatureKeyframe> keyframes;
+
+  // Tables for each color temperature used so far. Map nodes never move, so
+  // references handed out stay valid.
+  std::map<int, ColorShiftTables> tables_cache;
+  std::mutex tables_mutex;
+
+  bool stacked;
+
+  // Region of interest, mask mode and kernels. Only the rows of the region of
+  // interest are read or written when shifting in place.
+  ShiftFrameOptions shift_options;
+  ShiftFrameScratch shift_scratch;
+
+  // Optional clip selecting the pixels within the region to shift, see
+  // ShiftMask. A soft mask sets the strength of the shift per pixel instead.
+  PClip mask;
+  std::unique_ptr<ThreadPool> pool;
+
+  // Shifted frames by the hash of their source, only with a cache size. Long
+  // static stretches and duplicated frames are shifted once.
+  std::unique_ptr<FrameCache<PVideoFrame> > cache;
+  HashStripesFunc hash_stripes;
+
+  // only with a stats file
+  std::unique_ptr<FilterStats> stats;
+  std::string stats_file;
 
 public:
-  KelvinColorShift(PClip _child, int from_temp, int to_temp, IScriptEnvironment* env)
-    : GenericVideoFilter(_child) {
-    if (from_temp < 1000 || from_temp > 10000 ||
-        to_temp < 1000 || to_temp > 10000) {
-      env->ThrowError("KelvinColorShift: Color temperature must be between 1000 and 10000!");
-    }
+  KelvinColorShift(
+    PClip _child,
+    int from_temp,
+    int to_temp,
+    int threads,
+    bool stacked,
+    const char* keyframe_str,
+    bool auto_wb,
+    int sample_frames,
+    const char* stats_file,
+    int roi_x,
+    int roi_y,
+    int roi_width,
+    int roi_height,
+    PClip mask,
+    bool soft_mask,
+    int cache_mb,
+    IScriptEnvironment* env
+    ) : GenericVideoFilter(_child), from_temp(from_temp), stacked(stacked), mask(mask),
+      stats_file(stats_file) {
     if (!vi.IsRGB() && !(vi.IsPlanar() && vi.IsYUV())) {
       env->ThrowError("KelvinColorShift: Unsupported color format. RGB or planar YUV data only!");
     }
+    if (threads < 0) {
+      env->ThrowError("KelvinColorShift: Thread count must not be negative!");
+    }
+    if (stacked && (vi.IsRGB() || vi.height % 4 != 0)) {
+      // 16 bits per sample as an 8-bit clip twice the height, most significant
+      // bytes in the top half of each plane, so the chroma height must be even
+      env->ThrowError("KelvinColorShift: Stacked 16-bit data must be YV12 with a height divisible by 4!");
+    }
+    if (auto_wb && sample_frames < 1) {
+      env->ThrowError("KelvinColorShift: Sample frame count must be positive!");
+    }
+    if (cache_mb < 0) {
+      env->ThrowError("KelvinColorShift: Cache size must not be negative!");
+    }
 
-    RGB48 old_wb = ComputeWhiteBalance(from_temp);
-    RGB48 new_wb = ComputeWhiteBalance(to_temp);
-    rgb_shift = old_wb - new_wb;
+    // like Crop, a width or height of 0 or less is measured from the right or
+    // bottom edge
+    int picture_height = stacked ? vi.height / 2 : vi.height;
+    if (roi_width <= 0) {
+      roi_width += vi.width - roi_x;
+    }
+    if (roi_height <= 0) {
+      roi_height += picture_height - roi_y;
+    }
+    if (roi_x < 0 || roi_y < 0 || roi_width <= 0 || roi_height <= 0 ||
+        roi_x + roi_width > vi.width || roi_y + roi_height > picture_height) {
+      env->ThrowError("KelvinColorShift: Region of interest must lie within the frame!");
+    }
+    if (vi.IsYUV() && ((roi_x | roi_y | roi_width | roi_height) & 1)) {
+      // the chroma planes have half the width and height
+      env->ThrowError("KelvinColorShift: Region of interest must be mod 2 for YUV clips!");
+    }
+
+    if (mask) {
+      const VideoInfo& mask_vi = mask->GetVideoInfo();
+      if (stacked) {
+        env->ThrowError("KelvinColorShift: A mask can't be combined with stacked data!");
+      }
+      if (!mask_vi.IsRGB() && !(mask_vi.IsPlanar() && mask_vi.IsYUV())) {
+        env->ThrowError("KelvinColorShift: Unsupported mask format. RGB or planar YUV data only!");
+      }
+      if (mask_vi.width != vi.width || mask_vi.height != vi.height) {
+        env->ThrowError("KelvinColorShift: Mask clip does not match frame size!");
+      }
+    } else if (soft_mask) {
+      env->ThrowError("KelvinColorShift: Soft mask requires a mask clip!");
+    }
+
+    if (*keyframe_str != 0) {
+      if (!ParseKeyframes(keyframe_str, keyframes)) {
+        env->ThrowError("KelvinColorShift: Keyframes must be a list of frame:temperature pairs!");
+      }
+    } else {
+      TemperatureKeyframe keyframe = { 0, to_temp };
+      keyframes.push_back(keyframe);
+    }
 
-    // normalize the shift to preserve luminosity
-    rgb_shift = rgb_shift - rgb_shift.Y();
+    shift_options.width = vi.width;
+    shift_options.height = vi.height;
+    shift_options.bytes_per_pixel = vi.IsRGB() ? vi.BytesFromPixels(1) : 0;
+    shift_options.stacked = stacked;
+    shift_options.roi_x = roi_x;
+    shift_options.roi_y = roi_y;
+    shift_options.roi_width = roi_width;
+    shift_options.roi_height = roi_height;
+    shift_options.soft_mask = soft_mask;
+    shift_options.shift_row = GetShiftRowFunc(vi.IsRGB24() ? 3 : 4, env->GetCPUFlags());
+    shift_options.shift_stacked_row = GetShiftStackedRowFunc(env->GetCPUFlags());
+    shift_options.blend_row = GetBlendRowFunc(env->GetCPUFlags());
+    pool.reset(new ThreadPool(threads));
+    if (cache_mb > 0) {
+      cache.reset(new FrameCache<PVideoFrame>((size_t)cache_mb << 20));
+    }
+    hash_stripes = GetHashStripesFunc(env->GetCPUFlags());
+    if (!this->stats_file.empty()) {
+      stats.reset(new FilterStats("KelvinColorShift"));
+    }
+
+    if (auto_wb) {
+      this->from_temp = EstimateTemperature(sample_frames, env);
+    }
+
+    bool temps_valid = (this->from_temp >= 1000 && this->from_temp <= 10000);
+    for (size_t i = 0; i < keyframes.size(); i++) {
+      temps_valid = temps_valid && keyframes[i].temp >= 1000 && keyframes[i].temp <= 10000;
+      if (i > 0 && keyframes[i].frame <= keyframes[i - 1].frame) {
+        env->ThrowError("KelvinColorShift: Keyframes must be in ascending frame order!");
+      }
+    }
+    if (!temps_valid) {
+      env->ThrowError("KelvinColorShift: Color temperature must be between 1000 and 10000!");
+    }
   }
 
-  // Based on http://www.tannerhelland.com/4435/convert-temperature-rgb-algorithm-code/
-  RGB48 ComputeWhiteBalance(int temp) {
-    RGB48 white_balance;
-    double temp_fp = (double)temp / 100;
+  // Estimates the color temperature of the light the clip was shot in, assuming
+  // that the average color of a scene is gray. Looks at sample_frames frames
+  // spread evenly over the clip and at every AUTO_WB_ROW_STEP-th row of them.
+  int EstimateTemperature(int sample_frames, IScriptEnvironment* env) {
+    SumChannelsFunc sum_channels = GetSumChannelsFunc(env->GetCPUFlags());
+    if (sample_frames > vi.num_frames) {
+      sample_frames = vi.num_frames;
+    }
+
+    // B, G, R sums for RGB, Y, U, V sums for planar YUV
+    uint64_t totals[3] = { 0, 0, 0 };
+    uint64_t counts[3] = { 0, 0, 0 };
+    for (int i = 0; i < sample_frames; i++) {
+      PVideoFrame frame = child->GetFrame((int)((int64_t)i * vi.num_frames / sample_frames), env);
+      if (vi.IsRGB()) {
+        SumPlane(frame->GetReadPtr(), frame->GetPitch(), vi.width, vi.height,
+          vi.IsRGB24() ? 3 : 4, sum_channels, totals);
+        for (int c = 0; c < 3; c++) {
+          counts[c] += (uint64_t)vi.width * ((vi.height + AUTO_WB_ROW_STEP - 1) / AUTO_WB_ROW_STEP);
+        }
+      } else {
+        int planes[] = {
+          PLANAR_Y,
+          PLANAR_U,
+          PLANAR_V
+        };
+        for (int p = 0; p < (int)_countof(planes); p++) {
+          int width = frame->GetRowSize(planes[p]);
+          int height = frame->GetHeight(planes[p]);
+          if (stacked) {
+            // the most significant bytes are enough here
+            height /= 2;
+          }
+          uint64_t sums[3] = { 0, 0, 0 };
+          SumPlane(frame->GetReadPtr(planes[p]), frame->GetPitch(planes[p]), width, height,
+            1, sum_channels, sums);
+          totals[p] += sums[0];
+          counts[p] += (uint64_t)width * ((height + AUTO_WB_ROW_STEP - 1) / AUTO_WB_ROW_STEP);
+        }
+      }
+    }
 
-    // red
-    if (temp <= 6680) {
-      white_balance.R = SHRT_MAX;
+    double avg[3];
+    for (int c = 0; c < 3; c++) {
+      avg[c] = counts[c] ? (double)totals[c] / counts[c] : 0;
+    }
+    double r, g, b;
+    if (vi.IsRGB()) {
+      b = avg[0];
+      g = avg[1];
+      r = avg[2];
+    } else {
+      // inverse of RGB48::Y/U/V
+      double u = avg[1] - 128;
+      double v = avg[2] - 128;
+      r = avg[0] + 1.402 * v;
+      g = avg[0] - 0.344136 * u - 0.714136 * v;
+      b = avg[0] + 1.772 * u;
     }
-    else {
-      double r_fp = 329.698727446 * pow(temp_fp - 60, -0.1332047592);
-      white_balance.R = (short)(128 * r_fp);
+    r = std::max(r, 0.0);
+    g = std::max(g, 0.0);
+    b = std::max(b, 0.0);
+    double sum = r + g + b;
+    if (sum <= 0) {
+      // black footage, no cast to correct
+      return 6500;
     }
 
-    // green
-    double g_fp;
-    if (temp <= 6600) {
-      g_fp = 99.4708025861 * log(temp_fp) - 161.1195681661;
+    // pick the temperature whose white point has the closest chromaticity
+    int best_temp = 6500;
+    double best_error = std::numeric_limits<double>::max();
+    for (int temp = 1000; temp <= 10000; temp += AUTO_WB_TEMP_STEP) {
+      RGB48 wb = ComputeWhiteBalance(temp);
+      double wb_sum = (double)wb.R + wb.G + wb.B;
+      double error_r = wb.R / wb_sum - r / sum;
+      double error_b = wb.B / wb_sum - b / sum;
+      double error = error_r * error_r + error_b * error_b;
+      if (error < best_error) {
+        best_error = error;
+        best_temp = temp;
+      }
     }
-    else {
-      g_fp = 288.1221695283 * pow(temp_fp - 60, -0.0755148492);
+    return best_temp;
+  }
+
+  // Sums every AUTO_WB_ROW_STEP-th row of a plane, in parallel bands.
+  void SumPlane(
+    const unsigned char* ptr,
+    int pitch,
+    int width,
+    int height,
+    int bytes_per_pixel,
+    SumChannelsFunc sum_channels,
+    uint64_t totals[3]
+    ) {
+    int rows = (height + AUTO_WB_ROW_STEP - 1) / AUTO_WB_ROW_STEP;
+    int bands = GetBandCount(*pool, rows);
+    std::vector<uint64_t> band_sums(3 * bands);
+
+    pool->ParallelFor(bands, [&](int band) {
+      uint64_t* sums = &band_sums[3 * band];
+      for (int i = rows * band / bands; i < rows * (band + 1) / bands; i++) {
+        sum_channels(ptr + (size_t)i * AUTO_WB_ROW_STEP * pitch, width, bytes_per_pixel, sums);
+      }
+    });
+    for (int band = 0; band < bands; band++) {
+      for (int c = 0; c < 3; c++) {
+        totals[c] += band_sums[3 * band + c];
+      }
     }
-    white_balance.G = (short)(128 * g_fp);
+  }
 
-    // blue
-    if (temp >= 6540) {
-      white_balance.B = SHRT_MAX;
+  // Returns the target temperature of frame n, interpolating linearly between
+  // keyframes and holding the first and last one.
+  int GetTemperature(int n) const {
+    size_t next = 0;
+    while (next < keyframes.size() && keyframes[next].frame <= n) {
+      next++;
+    }
+    if (next == 0) {
+      return keyframes.front().temp;
     }
-    else if (temp <= 1900) {
-      white_balance.B = 0;
+    if (next == keyframes.size()) {
+      return keyframes.back().temp;
     }
-    else {
-      double b_fp = 138.5177312231 * log(temp_fp - 10) - 305.0447927307;
-      white_balance.B = (short)(128 * b_fp);
+
+    const TemperatureKeyframe& a = keyframes[next - 1];
+    const TemperatureKeyframe& b = keyframes[next];
+    double t = (double)(n - a.frame) / (b.frame - a.frame);
+    return a.temp + (int)floor((b.temp - a.temp) * t + 0.5);
+  }
+
+  // Returns the tables shifting from from_temp to to_temp, computing them on
+  // first use.
+  const ColorShiftTables& GetTables(int to_temp) {
+    std::lock_guard<std::mutex> lock(tables_mutex);
+    auto it = tables_cache.find(to_temp);
+    if (it == tables_cache.end()) {
+      ColorShiftTables tables(ComputeColorShift(from_temp, to_temp));
+      it = tables_cache.insert(std::make_pair(to_temp, tables)).first;
     }
+    return it->second;
+  }
 
-    return white_balance;
+  ~KelvinColorShift() {
+    if (stats) {
+      stats->Dump(stats_file.c_str());
+    }
   }
 
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
+    FrameTimer timer(stats.get());
+    int to_temp = GetTemperature(n);
+    const ColorShiftTables& tables = GetTables(to_temp);
+    PVideoFrame mask_frame;
+    if (mask) {
+      // a shorter mask holds its last frame
+      mask_frame = mask->GetFrame(std::min(n, mask->GetVideoInfo().num_frames - 1), env);
+    }
+
     PVideoFrame frame = child->GetFrame(n, env);
-    env->MakeWritable(&frame);
+    FrameCacheKey key;
+    if (cache) {
+      key.hash = HashFrame(frame, mask_frame);
+      key.temp = to_temp;
+      PVideoFrame cached;
+      if (cache->Lookup(key, cached)) {
+        return cached;
+      }
+    }
 
+    // IsWritable needs the only reference, so check it before dst takes one
+    PVideoFrame dst;
+    if (frame->IsWritable()) {
+      ShiftFrame(frame, frame, mask_frame, tables);
+      dst = frame;
+    } else {
+      // Someone else (typically the cache) still holds the source frame, so
+      // MakeWritable would copy it only for us to make another pass over the
+      // copy. Write the shifted pixels straight into a new frame instead.
+      timer.SetCopied();
+      dst = env->NewVideoFrame(vi);
+      ShiftFrame(frame, dst, mask_frame, tables);
+    }
+
+    if (cache) {
+      cache->Insert(key, dst, GetFrameBytes(dst));
+    }
+    return dst;
+  }
+
+private:
+  // Calls fn(ptr, pitch, row_size, height) for each plane of a frame of vi.
+  template<typename Fn>
+  static void ForEachPlane(const PVideoFrame& frame, const VideoInfo& vi, Fn fn) {
     if (vi.IsRGB()) {
-      unsigned char* ptr = frame->GetWritePtr();
-      int pitch = frame->GetPitch();
-      int row_size = frame->GetRowSize();
-      int height = frame->GetHeight();
-      int bytes_per_pixel = vi.IsRGB24() ? 3 : 4;
-
-      for (int y = 0; y < height; y++) {
-        for (int x = 0; x < row_size; x += bytes_per_pixel) {
-          RGB48 rgb(&ptr[x]);
-          rgb *= rgb_shift;
-          rgb.ToRGB8(&ptr[x]);
-        }
-        ptr += pitch;
-      }
+      fn(frame->GetReadPtr(), frame->GetPitch(), frame->GetRowSize(), frame->GetHeight());
+      return;
+    }
+    int planes[] = {
+      PLANAR_Y,
+      PLANAR_U,
+      PLANAR_V
+    };
+    for (int p = 0; p < (int)_countof(planes); p++) {
+      fn(frame->GetReadPtr(planes[p]), frame->GetPitch(planes[p]),
+        frame->GetRowSize(planes[p]), frame->GetHeight(planes[p]));
+    }
+  }
+
+  // Memory a frame of the clip holds on to, for the cache capacity.
+  size_t GetFrameBytes(const PVideoFrame& frame) const {
+    size_t bytes = 0;
+    ForEachPlane(frame, vi, [&](const unsigned char*, int pitch, int, int height) {
+      bytes += (size_t)pitch * height;
+    });
+    return bytes;
+  }
+
+  // Hashes the contents of frame and mask_frame, if any. The bands of each
+  // plane are hashed in parallel and their hashes hashed in order.
+  uint64_t HashFrame(const PVideoFrame& frame, const PVideoFrame& mask_frame) {
+    std::vector<uint64_t> band_hashes;
+    auto hash_plane = [&](const unsigned char* ptr, int pitch, int row_size, int height) {
+      HashPlaneBands(ptr, pitch, row_size, height, hash_stripes, *pool, band_hashes);
+    };
+    ForEachPlane(frame, vi, hash_plane);
+    if (mask_frame) {
+      ForEachPlane(mask_frame, mask->GetVideoInfo(), hash_plane);
+    }
+    return HashBandHashes(band_hashes, hash_stripes);
+  }
+
+  // Transforms src into dst, which may be the same frame, see ::ShiftFrame.
+  void ShiftFrame(
+    const PVideoFrame& src,
+    const PVideoFrame& dst,
+    const PVideoFrame& mask_frame,
+    const ColorShiftTables& tables
+    ) {
+    ShiftFramePlanes planes;
+    if (vi.IsRGB()) {
+      planes.src[0] = src->GetReadPtr();
+      planes.src_pitch[0] = src->GetPitch();
+      planes.dst[0] = dst->GetWritePtr();
+      planes.dst_pitch[0] = dst->GetPitch();
+      planes.row_size[0] = src->GetRowSize();
+      planes.height[0] = src->GetHeight();
     } else {
-      _ASSERT(vi.IsPlanar() && vi.IsYUV());
-      int planes[] = {
+      int plane_ids[] = {
+        PLANAR_Y,
         PLANAR_U,
         PLANAR_V
       };
-      char plane_shifts[] = {
-        (char)(rgb_shift.U() >> 8),
-        (char)(rgb_shift.V() >> 8)
-      };
-      C_ASSERT(_countof(planes) == _countof(plane_shifts));
-
-      for (int p = 0; p < _countof(planes); p++) {
-        unsigned char* ptr = frame->GetWritePtr(planes[p]);
-        int pitch = frame->GetPitch(planes[p]);
-        int row_size = frame->GetRowSize(planes[p]);
-        int height = frame->GetHeight(planes[p]);
-
-        for (int y = 0; y < height; y++) {
-          for (int x = 0; x < row_size; x++) {
-            ptr[x] = Helpers::Clamp<short, unsigned char>((short)ptr[x] + plane_shifts[p]);
-          }
-          ptr += pitch;
-        }
+      for (int p = 0; p < (int)_countof(plane_ids); p++) {
+        planes.src[p] = src->GetReadPtr(plane_ids[p]);
+        planes.src_pitch[p] = src->GetPitch(plane_ids[p]);
+        planes.dst[p] = dst->GetWritePtr(plane_ids[p]);
+        planes.dst_pitch[p] = dst->GetPitch(plane_ids[p]);
+        planes.row_size[p] = src->GetRowSize(plane_ids[p]);
+        planes.height[p] = src->GetHeight(plane_ids[p]);
       }
     }
 
-    return frame;
+    ShiftMask shift_mask;
+    if (mask_frame) {
+      const VideoInfo& mask_vi = mask->GetVideoInfo();
+      if (mask_vi.IsRGB()) {
+        // RGB frames are stored bottom-up
+        shift_mask.ptr = mask_frame->GetReadPtr();
+        shift_mask.pitch = mask_frame->GetPitch();
+        shift_mask.bytes_per_pixel = mask_vi.BytesFromPixels(1);
+        shift_mask.bottom_up = true;
+      } else {
+        shift_mask.ptr = mask_frame->GetReadPtr(PLANAR_Y);
+        shift_mask.pitch = mask_frame->GetPitch(PLANAR_Y);
+        shift_mask.bytes_per_pixel = 1;
+        shift_mask.bottom_up = false;
+      }
+      shift_mask.height = mask_vi.height;
+    }
+    ::ShiftFrame(planes, mask_frame ? &shift_mask : NULL, tables, shift_options, shift_scratch, *pool);
   }
 };
 
 AVSValue __cdecl Create_KelvinColorShift(AVSValue args, void* user_data, IScriptEnvironment* env) {
-  return new KelvinColorShift(args[0].AsClip(), args[1].AsInt(), args[2].AsInt(), env);
+  return new KelvinColorShift(
+    args[0].AsClip(),
+    args[1].AsInt(0),
+    args[2].AsInt(0),
+    args[3].AsInt(0),
+    args[4].AsBool(false),
+    args[5].AsString(""),
+    args[6].AsBool(false),
+    args[7].AsInt(16),
+    args[8].AsString(""),
+    args[9].AsInt(0),
+    args[10].AsInt(0),
+    args[11].AsInt(0),
+    args[12].AsInt(0),
+    args[13].Defined() ? args[13].AsClip() : PClip(),
+    args[14].AsBool(false),
+    args[15].AsInt(0),
+    env);
 }
 
 extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit2(IScriptEnvironment* env) {
-  env->AddFunction("KelvinColorShift", "c[from_temp]i[to_temp]i", Create_KelvinColorShift, 0);
+  env->AddFunction("KelvinColorShift", "c[from_temp]i[to_temp]i[threads]i[stacked]b[keyframes]s[auto_wb]b[sample_frames]i[stats_file]s[roi_x]i[roi_y]i[roi_width]i[roi_height]i[mask]c[soft_mask]b[cache_mb]i", Create_KelvinColorShift, 0);
   return "Kelvin color shifter plugin";
 }
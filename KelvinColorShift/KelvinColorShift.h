@@ -1,12 +1,31 @@
+#pragma once
+
+#include <climits>
+#include <limits>
+
+// Minimum number of rows in a band processed by one thread. Smaller frames are
+// not worth the synchronization.
+#define MIN_BAND_HEIGHT 64
+
+// Only every n-th row is looked at when estimating the color temperature.
+#define AUTO_WB_ROW_STEP 4
+
+// Resolution in Kelvin of the estimated color temperature.
+#define AUTO_WB_TEMP_STEP 10
+
+// Mask clip values from which on a pixel is shifted, unless the mask is soft.
+#define MASK_THRESHOLD 128
+
 class Helpers {
 public:
   template<typename S, typename D>
   static D Clamp(S v) {
-    if (v < std::numeric_limits<D>::min()) {
-      return std::numeric_limits<D>::min();
+    // parenthesized so that this also compiles where windows.h defines min and max
+    if (v < (std::numeric_limits<D>::min)()) {
+      return (std::numeric_limits<D>::min)();
     }
-    if (v > std::numeric_limits<D>::max()) {
-      return std::numeric_limits<D>::max();
+    if (v > (std::numeric_limits<D>::max)()) {
+      return (std::numeric_limits<D>::max)();
     }
     return (D)v;
   }
@@ -27,7 +46,7 @@ struct RGB48 {
   }
 
   // From BGR
-  RGB48(unsigned char* rgb8) :
+  RGB48(const unsigned char* rgb8) :
     RGB48((short)rgb8[2] * 128, (short)rgb8[1] * 128, (short)rgb8[0] * 128) {
   }
 
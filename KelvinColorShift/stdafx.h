@@ -9,7 +9,13 @@
 #define NOMINMAX                        // We want to use numeric_limits<T>::min()/max()
 
 #include <windows.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "..\avisynth.h"
@@ -0,0 +1,329 @@
+// ColorShiftFrameTests.cpp : Whole-frame KelvinColorShift against a per-pixel
+// reference.
+//
+
+#include "FilterTests.h"
+#include "ColorShiftFrame.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Random frames per format and mode, each shifted in place and out of place.
+#define FRAME_TEST_FRAMES 60
+
+namespace {
+
+enum FrameMaskMode {
+  FRAME_MASK_NONE,
+  FRAME_MASK_HARD,
+  FRAME_MASK_SOFT,
+};
+
+// The planes of a frame, each pitch bytes per row with random padding.
+struct TestFrame {
+  int planes;
+  std::vector<unsigned char> data[3];
+  int pitch[3];
+  int row_size[3];
+  int height[3];
+};
+
+TestFrame MakeTestFrame(const ShiftFrameOptions& options, TestRandom& random) {
+  TestFrame frame;
+  if (options.bytes_per_pixel != 0) {
+    frame.planes = 1;
+    frame.row_size[0] = options.width * options.bytes_per_pixel;
+    frame.height[0] = options.height;
+  } else {
+    frame.planes = 3;
+    frame.row_size[0] = options.width;
+    frame.height[0] = options.height;
+    for (int p = 1; p < 3; p++) {
+      frame.row_size[p] = options.width / 2;
+      frame.height[p] = options.height / 2;
+    }
+  }
+  for (int p = 0; p < frame.planes; p++) {
+    frame.pitch[p] = frame.row_size[p] + random.Below(33);
+    frame.data[p].resize((size_t)frame.pitch[p] * frame.height[p]);
+    random.Fill(&frame.data[p][0], frame.data[p].size());
+  }
+  return frame;
+}
+
+ShiftFramePlanes GetPlanes(const TestFrame& src, TestFrame& dst) {
+  ShiftFramePlanes planes = {};
+  for (int p = 0; p < src.planes; p++) {
+    planes.src[p] = &src.data[p][0];
+    planes.src_pitch[p] = src.pitch[p];
+    planes.dst[p] = &dst.data[p][0];
+    planes.dst_pitch[p] = dst.pitch[p];
+    planes.row_size[p] = src.row_size[p];
+    planes.height[p] = src.height[p];
+  }
+  return planes;
+}
+
+// A mask of width x height picture pixels: a top-down luma plane or a
+// bottom-up RGB frame. The values come in runs of 0, 255, the neighbors of
+// MASK_THRESHOLD or anything, so that rows split into runs of every action.
+struct TestMask {
+  std::vector<unsigned char> data;
+  ShiftMask mask;
+};
+
+void MakeTestMask(int width, int height, TestRandom& random, TestMask& test_mask) {
+  static const int bytes_per_pixel[] = { 1, 3, 4 };
+  ShiftMask& mask = test_mask.mask;
+  mask.bytes_per_pixel = bytes_per_pixel[random.Below(3)];
+  mask.bottom_up = (mask.bytes_per_pixel != 1);
+  mask.pitch = width * mask.bytes_per_pixel + random.Below(17);
+  mask.height = height;
+  test_mask.data.resize((size_t)mask.pitch * height);
+  random.Fill(&test_mask.data[0], test_mask.data.size());
+
+  for (int y = 0; y < height; y++) {
+    unsigned char* row = &test_mask.data[(size_t)y * mask.pitch];
+    int x = 0;
+    while (x < width) {
+      int run_end = std::min(width, x + random.Between(1, 12));
+      int kind = random.Below(4);
+      for (; x < run_end; x++) {
+        int value = kind == 0 ? 0 : (kind == 1 ? UCHAR_MAX : (kind == 2 ? MASK_THRESHOLD - random.Below(2) : -1));
+        for (int c = 0; c < mask.bytes_per_pixel; c++) {
+          // an RGB mask pixel counts with its brightest channel
+          int channel = value < 0 ? random.Below(256) : (c == 0 ? value : random.Below(value + 1));
+          row[x * mask.bytes_per_pixel + c] = (unsigned char)channel;
+        }
+      }
+    }
+  }
+  mask.ptr = &test_mask.data[0];
+}
+
+// The mask value of picture pixel (x, y), counted from the top left.
+int GetMaskValue(const ShiftMask& mask, int x, int y) {
+  const unsigned char* pixel = mask.ptr + (size_t)(mask.bottom_up ? mask.height - 1 - y : y) * mask.pitch +
+    x * mask.bytes_per_pixel;
+  return mask.bytes_per_pixel == 1 ? pixel[0] : std::max(pixel[0], std::max(pixel[1], pixel[2]));
+}
+
+// Picks the shifted or the source bytes of a pixel for mask value weight, or
+// blends them with a soft mask.
+void ApplyWeight(
+  const unsigned char* src,
+  const unsigned char* shifted,
+  unsigned char* dst,
+  int size,
+  int weight,
+  bool soft_mask
+  ) {
+  if (!soft_mask) {
+    memcpy(dst, weight >= MASK_THRESHOLD ? shifted : src, size);
+    return;
+  }
+  unsigned char weights[4];
+  memset(weights, weight, sizeof(weights));
+  BlendRow_C(src, shifted, dst, weights, size);
+}
+
+bool InRange(int value, int begin, int end) {
+  return value >= begin && value < end;
+}
+
+// What ShiftFrame has to leave in dst, which holds the frame it writes to
+// before the shift, worked out one pixel at a time with the scalar kernels.
+// The padding after each row is left alone.
+void ShiftFrameReference(
+  const TestFrame& src,
+  TestFrame& dst,
+  const ShiftMask* mask,
+  const ColorShiftTables& tables,
+  const ShiftFrameOptions& options
+  ) {
+  int roi_end_x = options.roi_x + options.roi_width;
+  int roi_end_y = options.roi_y + options.roi_height;
+  if (options.bytes_per_pixel != 0) {
+    int bytes_per_pixel = options.bytes_per_pixel;
+    ShiftRowFunc shift_row = bytes_per_pixel == 3 ? ShiftRowRGB24_C : ShiftRowRGB32_C;
+    for (int row = 0; row < options.height; row++) {
+      // RGB frames are stored bottom-up
+      int y = options.height - 1 - row;
+      for (int x = 0; x < options.width; x++) {
+        const unsigned char* s = &src.data[0][(size_t)row * src.pitch[0] + x * bytes_per_pixel];
+        unsigned char* d = &dst.data[0][(size_t)row * dst.pitch[0] + x * bytes_per_pixel];
+        if (!InRange(x, options.roi_x, roi_end_x) || !InRange(y, options.roi_y, roi_end_y)) {
+          memcpy(d, s, bytes_per_pixel);
+          continue;
+        }
+        unsigned char shifted[4];
+        shift_row(s, shifted, 1, tables);
+        ApplyWeight(s, shifted, d, bytes_per_pixel, mask ? GetMaskValue(*mask, x, y) : UCHAR_MAX, options.soft_mask);
+      }
+    }
+    return;
+  }
+
+  for (int y = 0; y < src.height[0]; y++) {
+    memcpy(&dst.data[0][(size_t)y * dst.pitch[0]], &src.data[0][(size_t)y * src.pitch[0]], src.row_size[0]);
+  }
+  int height = options.stacked ? src.height[1] / 2 : src.height[1];
+  for (int p = 1; p < 3; p++) {
+    const unsigned char* lut = p == 1 ? tables.plane_u : tables.plane_v;
+    int shift = p == 1 ? tables.stacked_shift_u : tables.stacked_shift_v;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < src.row_size[p]; x++) {
+        const unsigned char* s = &src.data[p][(size_t)y * src.pitch[p] + x];
+        unsigned char* d = &dst.data[p][(size_t)y * dst.pitch[p] + x];
+        size_t src_lsb = (size_t)height * src.pitch[p];
+        size_t dst_lsb = (size_t)height * dst.pitch[p];
+        bool inside = InRange(2 * x, options.roi_x, roi_end_x) && InRange(2 * y, options.roi_y, roi_end_y);
+        if (options.stacked) {
+          if (inside) {
+            ShiftStackedRow_C(s, s + src_lsb, d, d + dst_lsb, 1, shift);
+          } else {
+            d[0] = s[0];
+            d[dst_lsb] = s[src_lsb];
+          }
+          continue;
+        }
+        if (!inside) {
+          d[0] = s[0];
+          continue;
+        }
+        int weight = UCHAR_MAX;
+        if (mask) {
+          // the average of the 2x2 picture pixels the sample covers
+          weight = (GetMaskValue(*mask, 2 * x, 2 * y) + GetMaskValue(*mask, 2 * x + 1, 2 * y) +
+            GetMaskValue(*mask, 2 * x, 2 * y + 1) + GetMaskValue(*mask, 2 * x + 1, 2 * y + 1) + 2) / 4;
+        }
+        unsigned char shifted = lut[s[0]];
+        ApplyWeight(s, &shifted, d, 1, weight, options.soft_mask);
+      }
+    }
+  }
+}
+
+// A random frame size and region of interest for the format, mod 2 for YV12
+// and with a height divisible by 4 for stacked data. Frames are tall enough to
+// be split into several bands.
+ShiftFrameOptions RandomOptions(int bytes_per_pixel, bool stacked, TestRandom& random) {
+  ShiftFrameOptions options;
+  int align = bytes_per_pixel == 0 ? 2 : 1;
+  options.width = random.Between(1, 100) * align;
+  options.height = random.Between(1, 150) * (stacked ? 4 : align);
+  options.bytes_per_pixel = bytes_per_pixel;
+  options.stacked = stacked;
+
+  int picture_height = stacked ? options.height / 2 : options.height;
+  if (random.Below(4) == 0) {
+    options.roi_x = 0;
+    options.roi_y = 0;
+    options.roi_width = options.width;
+    options.roi_height = picture_height;
+  } else {
+    options.roi_x = random.Below(options.width / align) * align;
+    options.roi_y = random.Below(picture_height / align) * align;
+    options.roi_width = random.Between(1, (options.width - options.roi_x) / align) * align;
+    options.roi_height = random.Between(1, (picture_height - options.roi_y) / align) * align;
+  }
+
+  long cpu_flags = GetCpuFlags();
+  options.soft_mask = false;
+  options.shift_row = GetShiftRowFunc(bytes_per_pixel == 3 ? 3 : 4, cpu_flags);
+  options.shift_stacked_row = GetShiftStackedRowFunc(cpu_flags);
+  options.blend_row = GetBlendRowFunc(cpu_flags);
+  return options;
+}
+
+std::string FrameContext(int frame, const ShiftFrameOptions& options, const ShiftMask* mask) {
+  std::string context = "frame " + std::to_string(frame) + ", " + std::to_string(options.width) + "x" +
+    std::to_string(options.height) + ", roi " + std::to_string(options.roi_x) + "," + std::to_string(options.roi_y) +
+    " " + std::to_string(options.roi_width) + "x" + std::to_string(options.roi_height);
+  if (mask) {
+    context += ", mask of " + std::to_string(mask->bytes_per_pixel) + " bytes per pixel";
+  }
+  return context;
+}
+
+bool ExpectSameFrame(const TestFrame& expected, const TestFrame& actual, const std::string& context) {
+  for (int p = 0; p < expected.planes; p++) {
+    if (!EXPECT_BYTES_EQ(&expected.data[p][0], &actual.data[p][0], expected.data[p].size(),
+      context + ", plane " + std::to_string(p))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Shifts random frames into a random frame and in place, with a scratch and a
+// pool shared by all of them as in the filter, and compares every byte of
+// every plane with the reference. Pixels outside the region of interest or
+// the mask have to come out as they were in the source.
+void TestShiftFrame(int bytes_per_pixel, bool stacked, FrameMaskMode mask_mode) {
+  TestRandom random(17 + 5 * bytes_per_pixel + 3 * (int)stacked + mask_mode);
+  ThreadPool pool(4);
+  ShiftFrameScratch scratch;
+  for (int i = 0; i < FRAME_TEST_FRAMES; i++) {
+    ShiftFrameOptions options = RandomOptions(bytes_per_pixel, stacked, random);
+    options.soft_mask = (mask_mode == FRAME_MASK_SOFT);
+    ColorShiftTables tables(ComputeColorShift(random.Between(1000, 10000), random.Between(1000, 10000)));
+    TestFrame src = MakeTestFrame(options, random);
+    TestMask test_mask;
+    const ShiftMask* mask = NULL;
+    if (mask_mode != FRAME_MASK_NONE) {
+      MakeTestMask(options.width, options.height, random, test_mask);
+      mask = &test_mask.mask;
+    }
+
+    TestFrame dst = MakeTestFrame(options, random);
+    TestFrame expected = dst;
+    ShiftFrameReference(src, expected, mask, tables, options);
+    ShiftFrame(GetPlanes(src, dst), mask, tables, options, scratch, pool);
+    if (!ExpectSameFrame(expected, dst, "out of place, " + FrameContext(i, options, mask))) {
+      return;
+    }
+
+    TestFrame in_place = src;
+    expected = src;
+    ShiftFrameReference(src, expected, mask, tables, options);
+    ShiftFrame(GetPlanes(in_place, in_place), mask, tables, options, scratch, pool);
+    if (!ExpectSameFrame(expected, in_place, "in place, " + FrameContext(i, options, mask))) {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+void RegisterShiftFrameTests() {
+  struct {
+    const char* name;
+    int bytes_per_pixel;
+    bool stacked;
+    FrameMaskMode mask_mode;
+  } cases[] = {
+    { "RGB24/roi", 3, false, FRAME_MASK_NONE },
+    { "RGB24/mask:hard", 3, false, FRAME_MASK_HARD },
+    { "RGB24/mask:soft", 3, false, FRAME_MASK_SOFT },
+    { "RGB32/roi", 4, false, FRAME_MASK_NONE },
+    { "RGB32/mask:hard", 4, false, FRAME_MASK_HARD },
+    { "RGB32/mask:soft", 4, false, FRAME_MASK_SOFT },
+    { "YV12/roi", 0, false, FRAME_MASK_NONE },
+    { "YV12/mask:hard", 0, false, FRAME_MASK_HARD },
+    { "YV12/mask:soft", 0, false, FRAME_MASK_SOFT },
+    { "YV12/stacked", 0, true, FRAME_MASK_NONE },
+  };
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    int bytes_per_pixel = cases[c].bytes_per_pixel;
+    bool stacked = cases[c].stacked;
+    FrameMaskMode mask_mode = cases[c].mask_mode;
+    RegisterTest(std::string("ShiftFrame/") + cases[c].name, [=]() {
+      TestShiftFrame(bytes_per_pixel, stacked, mask_mode);
+    });
+  }
+}
@@ -0,0 +1,342 @@
+// ColorShiftKernelTests.cpp : KelvinColorShift row kernels against the RGB48 and scalar references.
+//
+
+#include "FilterTests.h"
+#include "ColorShiftKernels.h"
+#include "CpuFeatures.h"
+
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Random rows per kernel and mode.
+#define SHIFT_TEST_ROWS 300
+
+// Widest random row, in pixels.
+#define SHIFT_TEST_MAX_WIDTH 150
+
+// Largest misalignment of src and dst, in bytes.
+#define SHIFT_TEST_MAX_OFFSET 31
+
+// Bytes after the end of dst that must stay unchanged.
+#define SHIFT_TEST_GUARD 32
+
+namespace {
+
+// Color temperatures the shifts are picked from, including the extremes that
+// drive the channels into clamping.
+const int TEST_TEMPS[] = { 1000, 1900, 3200, 5500, 6500, 6600, 6700, 10000 };
+
+ColorShiftTables RandomTables(TestRandom& random) {
+  int count = (int)(sizeof(TEST_TEMPS) / sizeof(TEST_TEMPS[0]));
+  int from_temp = random.Below(3) == 0 ? random.Between(1000, 10000) : TEST_TEMPS[random.Below(count)];
+  int to_temp = random.Below(3) == 0 ? random.Between(1000, 10000) : TEST_TEMPS[random.Below(count)];
+  return ColorShiftTables(ComputeColorShift(from_temp, to_temp));
+}
+
+// What KelvinColorShift did per pixel before it had row kernels.
+void ShiftRowReference(const unsigned char* src, unsigned char* dst, int width, int bytes_per_pixel, RGB48 shift) {
+  for (int x = 0; x < width; x++) {
+    RGB48 pixel(&src[x * bytes_per_pixel]);
+    pixel *= shift;
+    pixel.ToRGB8(&dst[x * bytes_per_pixel]);
+    if (bytes_per_pixel == 4) {
+      dst[x * bytes_per_pixel + 3] = src[x * bytes_per_pixel + 3];
+    }
+  }
+}
+
+std::string RowContext(int row, int width, int src_offset, int dst_offset) {
+  return "row " + std::to_string(row) + ", width " + std::to_string(width) +
+    ", src offset " + std::to_string(src_offset) + ", dst offset " + std::to_string(dst_offset);
+}
+
+// Shifts random rows of random width and alignment out of place and in place
+// and compares every byte of dst, including the guard bytes around the row,
+// with the reference. src ends exactly at the end of the row, so that reads
+// past it show up under AddressSanitizer.
+void TestShiftRow(ShiftRowFunc shift_row, int bytes_per_pixel, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  TestRandom random(1);
+  for (int row = 0; row < SHIFT_TEST_ROWS; row++) {
+    ColorShiftTables tables = RandomTables(random);
+    int width = random.Below(SHIFT_TEST_MAX_WIDTH + 1);
+    int src_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    int dst_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    size_t row_size = (size_t)width * bytes_per_pixel;
+
+    std::vector<unsigned char> src(src_offset + row_size);
+    random.Fill(src.data(), src.size());
+    std::vector<unsigned char> dst(dst_offset + row_size + SHIFT_TEST_GUARD);
+    random.Fill(&dst[0], dst.size());
+    std::vector<unsigned char> expected(dst);
+    ShiftRowReference(src.data() + src_offset, &expected[dst_offset], width, bytes_per_pixel, tables.shift);
+
+    shift_row(src.data() + src_offset, &dst[dst_offset], width, tables);
+    std::string context = RowContext(row, width, src_offset, dst_offset);
+    if (!EXPECT_BYTES_EQ(&expected[0], &dst[0], dst.size(), "out of place, " + context)) {
+      return;
+    }
+
+    // in place, the source row at the alignment of dst
+    std::vector<unsigned char> in_place(expected.size());
+    random.Fill(&in_place[0], in_place.size());
+    if (row_size > 0) {
+      memcpy(&in_place[dst_offset], src.data() + src_offset, row_size);
+    }
+    memcpy(&expected[0], &in_place[0], expected.size());
+    ShiftRowReference(src.data() + src_offset, &expected[dst_offset], width, bytes_per_pixel, tables.shift);
+
+    shift_row(&in_place[dst_offset], &in_place[dst_offset], width, tables);
+    if (!EXPECT_BYTES_EQ(&expected[0], &in_place[0], in_place.size(), "in place, " + context)) {
+      return;
+    }
+  }
+}
+
+// Adds shift to 16-bit samples and clamps them to [0, 65535].
+void ShiftStackedRowReference(
+  const unsigned char* src_msb,
+  const unsigned char* src_lsb,
+  unsigned char* dst_msb,
+  unsigned char* dst_lsb,
+  int width,
+  int shift
+  ) {
+  for (int x = 0; x < width; x++) {
+    long long v = (long long)(src_msb[x] * 256 + src_lsb[x]) + shift;
+    v = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+    dst_msb[x] = (unsigned char)(v / 256);
+    dst_lsb[x] = (unsigned char)(v % 256);
+  }
+}
+
+void TestShiftStackedRow(ShiftStackedRowFunc shift_stacked_row) {
+  TestRandom random(2);
+  for (int row = 0; row < SHIFT_TEST_ROWS; row++) {
+    // the shifts of real tables are small, large ones saturate whole rows
+    ColorShiftTables tables = RandomTables(random);
+    int shift = random.Below(2) ? tables.stacked_shift_u : random.Between(-USHRT_MAX, USHRT_MAX);
+    int width = random.Below(SHIFT_TEST_MAX_WIDTH + 1);
+    int src_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    int dst_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+
+    // msb and lsb rows one after the other, like the rows of a stacked plane
+    std::vector<unsigned char> src(src_offset + 2 * (size_t)width);
+    random.Fill(src.data(), src.size());
+    std::vector<unsigned char> dst(dst_offset + 2 * (size_t)width + SHIFT_TEST_GUARD);
+    random.Fill(&dst[0], dst.size());
+    std::vector<unsigned char> expected(dst);
+    const unsigned char* s = src.data() + src_offset;
+    ShiftStackedRowReference(s, s + width, &expected[dst_offset], &expected[dst_offset + width], width, shift);
+
+    shift_stacked_row(s, s + width, &dst[dst_offset], &dst[dst_offset + width], width, shift);
+    std::string context = RowContext(row, width, src_offset, dst_offset) + ", shift " + std::to_string(shift);
+    if (!EXPECT_BYTES_EQ(&expected[0], &dst[0], dst.size(), "out of place, " + context)) {
+      return;
+    }
+
+    std::vector<unsigned char> in_place(expected.size());
+    random.Fill(&in_place[0], in_place.size());
+    if (width > 0) {
+      memcpy(&in_place[dst_offset], s, 2 * (size_t)width);
+    }
+    memcpy(&expected[0], &in_place[0], expected.size());
+    ShiftStackedRowReference(s, s + width, &expected[dst_offset], &expected[dst_offset + width], width, shift);
+
+    unsigned char* d = &in_place[dst_offset];
+    shift_stacked_row(d, d + width, d, d + width, width, shift);
+    if (!EXPECT_BYTES_EQ(&expected[0], &in_place[0], in_place.size(), "in place, " + context)) {
+      return;
+    }
+  }
+}
+
+// Blends every pair of source and shifted bytes with every weight, so that
+// the 0..255 to 0..256 weight mapping and the rounding match everywhere. 0
+// has to give the source and 255 the shifted bytes exactly.
+void TestBlendWeights(BlendRowFunc blend_row, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  std::vector<unsigned char> src(65536);
+  std::vector<unsigned char> shifted(65536);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = (unsigned char)(i >> 8);
+    shifted[i] = (unsigned char)i;
+  }
+  std::vector<unsigned char> weights(src.size());
+  std::vector<unsigned char> expected(src.size());
+  std::vector<unsigned char> actual(src.size());
+  for (int w = 0; w <= UCHAR_MAX; w++) {
+    weights.assign(weights.size(), (unsigned char)w);
+    BlendRow_C(&src[0], &shifted[0], &expected[0], &weights[0], (int)src.size());
+    blend_row(&src[0], &shifted[0], &actual[0], &weights[0], (int)src.size());
+    std::string context = "weight " + std::to_string(w);
+    if (!EXPECT_BYTES_EQ(&expected[0], &actual[0], actual.size(), context)) {
+      return;
+    }
+    if (w == 0 && !EXPECT_BYTES_EQ(&src[0], &actual[0], actual.size(), context)) {
+      return;
+    }
+    if (w == UCHAR_MAX && !EXPECT_BYTES_EQ(&shifted[0], &actual[0], actual.size(), context)) {
+      return;
+    }
+  }
+}
+
+// Blends random rows of random length and alignment with random weights into
+// a separate row and in place into either input, comparing dst and the guard
+// bytes after it with BlendRow_C. The inputs end exactly at the end of the
+// row, so that reads past it show up under AddressSanitizer.
+void TestBlendRow(BlendRowFunc blend_row, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  TestRandom random(4);
+  for (int row = 0; row < SHIFT_TEST_ROWS; row++) {
+    int count = random.Below(SHIFT_TEST_MAX_WIDTH + 1);
+    int src_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    int dst_offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    std::vector<unsigned char> src(src_offset + count);
+    std::vector<unsigned char> shifted(src_offset + count);
+    std::vector<unsigned char> weights(src_offset + count);
+    random.Fill(src.data(), src.size());
+    random.Fill(shifted.data(), shifted.size());
+    random.Fill(weights.data(), weights.size());
+    const unsigned char* s = src.data() + src_offset;
+    const unsigned char* t = shifted.data() + src_offset;
+    const unsigned char* w = weights.data() + src_offset;
+
+    std::vector<unsigned char> dst(dst_offset + count + SHIFT_TEST_GUARD);
+    random.Fill(&dst[0], dst.size());
+    std::vector<unsigned char> expected(dst);
+    BlendRow_C(s, t, &expected[dst_offset], w, count);
+    blend_row(s, t, &dst[dst_offset], w, count);
+    std::string context = RowContext(row, count, src_offset, dst_offset);
+    if (!EXPECT_BYTES_EQ(&expected[0], &dst[0], dst.size(), "out of place, " + context)) {
+      return;
+    }
+
+    // in place over src, then over shifted, as ShiftFrame blends into dst
+    for (int over_shifted = 0; over_shifted < 2; over_shifted++) {
+      std::vector<unsigned char> in_place(dst.size());
+      random.Fill(&in_place[0], in_place.size());
+      if (count > 0) {
+        memcpy(&in_place[dst_offset], over_shifted ? t : s, count);
+      }
+      memcpy(&expected[0], &in_place[0], expected.size());
+      BlendRow_C(s, t, &expected[dst_offset], w, count);
+
+      unsigned char* d = &in_place[dst_offset];
+      blend_row(over_shifted ? s : d, over_shifted ? d : t, d, w, count);
+      if (!EXPECT_BYTES_EQ(&expected[0], &in_place[0], in_place.size(),
+        std::string(over_shifted ? "over shifted, " : "over src, ") + context)) {
+        return;
+      }
+    }
+  }
+}
+
+// Sums random rows of odd and even widths at every alignment onto random
+// running sums, as auto_wb does row after row. Blocks of sixteen pixels and
+// the scalar tail both have to add each channel to its own sum. The row ends
+// exactly after the last pixel, so that reads past it show up under
+// AddressSanitizer.
+void TestSumChannels(SumChannelsFunc sum_channels, int bytes_per_pixel) {
+  TestRandom random(9 + bytes_per_pixel);
+  for (int row = 0; row < SHIFT_TEST_ROWS; row++) {
+    int width = random.Below(SHIFT_TEST_MAX_WIDTH + 1) | (row % 2);
+    int offset = random.Below(SHIFT_TEST_MAX_OFFSET + 1);
+    std::vector<unsigned char> data(offset + (size_t)width * bytes_per_pixel);
+    random.Fill(data.data(), data.size());
+
+    uint64_t expected[3];
+    for (int c = 0; c < 3; c++) {
+      expected[c] = random.Next();
+    }
+    uint64_t actual[3] = { expected[0], expected[1], expected[2] };
+    SumChannels_C(data.data() + offset, width, bytes_per_pixel, expected);
+    sum_channels(data.data() + offset, width, bytes_per_pixel, actual);
+    std::string context = "row " + std::to_string(row) + ", width " + std::to_string(width) +
+      ", offset " + std::to_string(offset);
+    if (!EXPECT_BYTES_EQ((const unsigned char*)expected, (const unsigned char*)actual, sizeof(expected), context)) {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+void RegisterColorShiftKernelTests() {
+  struct {
+    const char* name;
+    ShiftRowFunc shift_row;
+    int bytes_per_pixel;
+    bool (*supported)();
+  } kernels[] = {
+    { "RGB24/C", ShiftRowRGB24_C, 3, NULL },
+    { "RGB24/SSE2", ShiftRowRGB24_SSE2, 3, NULL },
+    { "RGB24/SSSE3", ShiftRowRGB24_SSSE3, 3, IsSSSE3Supported },
+    { "RGB24/AVX2", ShiftRowRGB24_AVX2, 3, IsAVX2Supported },
+    { "RGB32/C", ShiftRowRGB32_C, 4, NULL },
+    { "RGB32/SSE2", ShiftRowRGB32_SSE2, 4, NULL },
+    { "RGB32/AVX2", ShiftRowRGB32_AVX2, 4, IsAVX2Supported },
+  };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    ShiftRowFunc shift_row = kernels[k].shift_row;
+    int bytes_per_pixel = kernels[k].bytes_per_pixel;
+    bool (*supported)() = kernels[k].supported;
+    RegisterTest(std::string("ColorShiftKernels/ShiftRow/") + kernels[k].name, [=]() {
+      TestShiftRow(shift_row, bytes_per_pixel, supported);
+    });
+  }
+
+  // GetShiftStackedRowFunc picks between these two only
+  RegisterTest("ColorShiftKernels/ShiftStackedRow/C", []() {
+    TestShiftStackedRow(ShiftStackedRow_C);
+  });
+  RegisterTest("ColorShiftKernels/ShiftStackedRow/SSE2", []() {
+    TestShiftStackedRow(ShiftStackedRow_SSE2);
+  });
+
+  struct {
+    const char* name;
+    BlendRowFunc blend_row;
+    bool (*supported)();
+  } blend_kernels[] = {
+    { "C", BlendRow_C, NULL },
+    { "SSE2", BlendRow_SSE2, NULL },
+    { "AVX2", BlendRow_AVX2, IsAVX2Supported },
+  };
+  for (size_t k = 0; k < sizeof(blend_kernels) / sizeof(blend_kernels[0]); k++) {
+    BlendRowFunc blend_row = blend_kernels[k].blend_row;
+    bool (*supported)() = blend_kernels[k].supported;
+    RegisterTest(std::string("ColorShiftKernels/BlendRow/Weights/") + blend_kernels[k].name, [=]() {
+      TestBlendWeights(blend_row, supported);
+    });
+    if (blend_row != BlendRow_C) {
+      RegisterTest(std::string("ColorShiftKernels/BlendRow/RandomRows/") + blend_kernels[k].name, [=]() {
+        TestBlendRow(blend_row, supported);
+      });
+    }
+  }
+
+  // the planar samples of YUV clips are summed one byte per pixel
+  const int sum_bytes_per_pixel[] = { 1, 3, 4 };
+  for (size_t b = 0; b < sizeof(sum_bytes_per_pixel) / sizeof(sum_bytes_per_pixel[0]); b++) {
+    int bpp = sum_bytes_per_pixel[b];
+    RegisterTest("ColorShiftKernels/SumChannels/SSE2/bpp:" + std::to_string(bpp), [=]() {
+      TestSumChannels(SumChannels_SSE2, bpp);
+    });
+  }
+}
@@ -0,0 +1,314 @@
+// DeadPixelStatsTests.cpp : DetectDeadPixels counters against a per-pixel
+// reference, and the threshold they are judged by.
+//
+
+#include "FilterTests.h"
+#include "DeadPixelStats.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Random clips per pixel size, each analyzed frame by frame.
+#define STATS_TEST_CLIPS 40
+#define STATS_TEST_FRAMES 6
+
+namespace {
+
+// A frame of width x height pixels, pitch bytes per row.
+struct StatsFrame {
+  int width;
+  int height;
+  int bytes_per_pixel;
+  int pitch;
+  std::vector<unsigned char> data;
+
+  StatsFrame(int width, int height, int bytes_per_pixel, int pitch)
+    : width(width), height(height), bytes_per_pixel(bytes_per_pixel), pitch(pitch),
+      data((size_t)pitch * height) {
+  }
+
+  unsigned char* Pixel(int x, int y) {
+    return &data[(size_t)y * pitch + x * bytes_per_pixel];
+  }
+  const unsigned char* Pixel(int x, int y) const {
+    return &data[(size_t)y * pitch + x * bytes_per_pixel];
+  }
+};
+
+// The same pixels at another pitch, with different padding.
+StatsFrame Repitch(const StatsFrame& frame, int pitch, TestRandom& random) {
+  StatsFrame copy(frame.width, frame.height, frame.bytes_per_pixel, pitch);
+  random.Fill(&copy.data[0], copy.data.size());
+  for (int y = 0; y < frame.height; y++) {
+    memcpy(copy.Pixel(0, y), frame.Pixel(0, y), (size_t)frame.width * frame.bytes_per_pixel);
+  }
+  return copy;
+}
+
+int Mirror(int i, int size) {
+  return i < 0 ? 1 : (i >= size ? size - 2 : i);
+}
+
+bool SamePixel(const unsigned char* a, const unsigned char* b, int channels) {
+  return memcmp(a, b, channels) == 0;
+}
+
+// Updates stats the way the counters are defined: a pixel is an outlier if
+// a channel differs from the rounded average of the four neighbors by more
+// than threshold, and stuck if it kept its value while a neighbor did not.
+// Neighbors outside the frame are mirrored.
+void AddFrameReference(DeadPixelStats& stats, const StatsFrame& frame, const StatsFrame* previous, int threshold) {
+  int channels = frame.bytes_per_pixel < 3 ? frame.bytes_per_pixel : 3;
+  for (int y = 0; y < frame.height; y++) {
+    for (int x = 0; x < frame.width; x++) {
+      const int neighbors[4][2] = {
+        { Mirror(x - 1, frame.width), y },
+        { Mirror(x + 1, frame.width), y },
+        { x, Mirror(y - 1, frame.height) },
+        { x, Mirror(y + 1, frame.height) }
+      };
+      size_t index = (size_t)y * frame.width + x;
+
+      bool outlier = false;
+      for (int c = 0; c < channels; c++) {
+        int sum = 0;
+        for (int i = 0; i < 4; i++) {
+          sum += frame.Pixel(neighbors[i][0], neighbors[i][1])[c];
+        }
+        outlier = outlier || abs(frame.Pixel(x, y)[c] - (sum + 2) / 4) > threshold;
+      }
+      if (outlier) {
+        stats.outlier_counts[index]++;
+      }
+
+      if (previous == NULL || !SamePixel(frame.Pixel(x, y), previous->Pixel(x, y), channels)) {
+        continue;
+      }
+      for (int i = 0; i < 4; i++) {
+        int nx = neighbors[i][0];
+        int ny = neighbors[i][1];
+        if (!SamePixel(frame.Pixel(nx, ny), previous->Pixel(nx, ny), channels)) {
+          stats.stuck_counts[index]++;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Adds frame to stats in a few bands of random height, as DetectDeadPixels
+// does on its threads.
+void AddFrameInBands(
+  DeadPixelStats& stats,
+  const StatsFrame& frame,
+  const StatsFrame* previous,
+  int threshold,
+  TestRandom& random
+  ) {
+  int y = 0;
+  while (y < frame.height) {
+    int y_end = y + random.Between(1, frame.height - y);
+    stats.AddFrame(&frame.data[0], frame.pitch, previous ? &previous->data[0] : NULL, previous ? previous->pitch : 0,
+      frame.bytes_per_pixel, threshold, y, y_end);
+    y = y_end;
+  }
+}
+
+// The next frame of a clip: most pixels keep their value, the rest change,
+// so that plenty of pixels keep their value next to changing ones. A few
+// pixels are set far off their surroundings.
+StatsFrame NextFrame(const StatsFrame& frame, TestRandom& random) {
+  StatsFrame next(frame.width, frame.height, frame.bytes_per_pixel,
+    frame.width * frame.bytes_per_pixel + random.Below(17));
+  random.Fill(&next.data[0], next.data.size());
+  for (int y = 0; y < frame.height; y++) {
+    for (int x = 0; x < frame.width; x++) {
+      unsigned char* pixel = next.Pixel(x, y);
+      int kind = random.Below(8);
+      if (kind < 5) {
+        memcpy(pixel, frame.Pixel(x, y), frame.bytes_per_pixel);
+      } else if (kind == 5) {
+        memset(pixel, random.Below(2) ? 0 : 255, frame.bytes_per_pixel);
+      }
+    }
+  }
+  return next;
+}
+
+std::string StatsContext(int clip, int frame, const StatsFrame& f) {
+  return "clip " + std::to_string(clip) + ", frame " + std::to_string(frame) + ", " + std::to_string(f.width) +
+    "x" + std::to_string(f.height) + ", pitch " + std::to_string(f.pitch);
+}
+
+bool ExpectSameCounts(const DeadPixelStats& expected, const DeadPixelStats& actual, const std::string& context) {
+  size_t size = expected.outlier_counts.size() * sizeof(uint16_t);
+  return EXPECT_BYTES_EQ((const unsigned char*)&expected.outlier_counts[0],
+      (const unsigned char*)&actual.outlier_counts[0], size, "outlier counts, " + context) &&
+    EXPECT_BYTES_EQ((const unsigned char*)&expected.stuck_counts[0],
+      (const unsigned char*)&actual.stuck_counts[0], size, "stuck counts, " + context);
+}
+
+// Analyzes random clips frame by frame, every frame at another pitch than the
+// one before, and compares both counters with the reference after each one.
+void TestRandomClips(int bytes_per_pixel) {
+  TestRandom random(19 + bytes_per_pixel);
+  for (int clip = 0; clip < STATS_TEST_CLIPS; clip++) {
+    int width = random.Between(2, 40);
+    int height = random.Between(2, 40);
+    int threshold = random.Between(0, 80);
+    StatsFrame frame(width, height, bytes_per_pixel, width * bytes_per_pixel + random.Below(17));
+    random.Fill(&frame.data[0], frame.data.size());
+
+    DeadPixelStats expected(width, height);
+    DeadPixelStats actual(width, height);
+    AddFrameReference(expected, frame, NULL, threshold);
+    AddFrameInBands(actual, frame, NULL, threshold, random);
+    if (!ExpectSameCounts(expected, actual, StatsContext(clip, 0, frame))) {
+      return;
+    }
+    for (int f = 1; f < STATS_TEST_FRAMES; f++) {
+      StatsFrame next = NextFrame(frame, random);
+      AddFrameReference(expected, next, &frame, threshold);
+      AddFrameInBands(actual, next, &frame, threshold, random);
+      if (!ExpectSameCounts(expected, actual, StatsContext(clip, f, next))) {
+        return;
+      }
+      frame = next;
+    }
+  }
+}
+
+// A flat frame with one pixel threshold + 1 above its neighbors' average and
+// one exactly threshold above it, next to the corner where the neighbors are
+// mirrored. The alpha of RGB32 pixels doesn't count.
+void TestOutliers(int bytes_per_pixel) {
+  const int threshold = 40;
+  StatsFrame frame(8, 6, bytes_per_pixel, 8 * bytes_per_pixel);
+  memset(&frame.data[0], 100, frame.data.size());
+  frame.Pixel(0, 0)[bytes_per_pixel - 1 < 2 ? bytes_per_pixel - 1 : 2] = 100 + threshold + 1;
+  frame.Pixel(5, 3)[0] = 100 + threshold;
+  if (bytes_per_pixel == 4) {
+    frame.Pixel(3, 1)[3] = 255;
+  }
+
+  DeadPixelStats stats(8, 6);
+  stats.AddFrame(&frame.data[0], frame.pitch, NULL, 0, bytes_per_pixel, threshold, 0, 6);
+  for (int y = 0; y < 6; y++) {
+    for (int x = 0; x < 8; x++) {
+      int expected = (x == 0 && y == 0) ? 1 : 0;
+      std::string context = "pixel " + std::to_string(x) + "," + std::to_string(y);
+      if (!EXPECT_TRUE(stats.outlier_counts[(size_t)y * 8 + x] == expected, context) ||
+        !EXPECT_TRUE(stats.stuck_counts[(size_t)y * 8 + x] == 0, context)) {
+        return;
+      }
+    }
+  }
+}
+
+// Every pixel but one changes from one frame to the next, which makes that
+// one stuck. A frame that doesn't change at all makes nothing stuck.
+void TestStuck(int bytes_per_pixel) {
+  TestRandom random(23 + bytes_per_pixel);
+  StatsFrame first(7, 5, bytes_per_pixel, 7 * bytes_per_pixel);
+  random.Fill(&first.data[0], first.data.size());
+  StatsFrame second = first;
+  for (size_t i = 0; i < second.data.size(); i++) {
+    second.data[i] ^= 0x55;
+  }
+  memcpy(second.Pixel(6, 2), first.Pixel(6, 2), bytes_per_pixel);
+
+  DeadPixelStats stats(7, 5);
+  stats.AddFrame(&first.data[0], first.pitch, NULL, 0, bytes_per_pixel, 255, 0, 5);
+  stats.AddFrame(&second.data[0], second.pitch, &first.data[0], first.pitch, bytes_per_pixel, 255, 0, 5);
+  stats.AddFrame(&second.data[0], second.pitch, &second.data[0], second.pitch, bytes_per_pixel, 255, 0, 5);
+  for (size_t i = 0; i < stats.stuck_counts.size(); i++) {
+    int expected = (i == 2 * 7 + 6) ? 1 : 0;
+    if (!EXPECT_TRUE(stats.stuck_counts[i] == expected, "pixel " + std::to_string(i))) {
+      return;
+    }
+  }
+}
+
+// The previous frame may come with another pitch than the current one, both
+// narrower and wider. The counts must not depend on either pitch.
+void TestPreviousPitch(int bytes_per_pixel) {
+  TestRandom random(29 + bytes_per_pixel);
+  for (int clip = 0; clip < STATS_TEST_CLIPS; clip++) {
+    int width = random.Between(2, 40);
+    int height = random.Between(2, 40);
+    int row_size = width * bytes_per_pixel;
+    StatsFrame previous(width, height, bytes_per_pixel, row_size + random.Below(33));
+    random.Fill(&previous.data[0], previous.data.size());
+    StatsFrame frame = NextFrame(previous, random);
+
+    DeadPixelStats expected(width, height);
+    StatsFrame same_pitch = Repitch(previous, frame.pitch, random);
+    expected.AddFrame(&frame.data[0], frame.pitch, &same_pitch.data[0], same_pitch.pitch, bytes_per_pixel, 30,
+      0, height);
+
+    DeadPixelStats actual(width, height);
+    actual.AddFrame(&frame.data[0], frame.pitch, &previous.data[0], previous.pitch, bytes_per_pixel, 30, 0, height);
+    std::string context = StatsContext(clip, 1, frame) + ", previous pitch " + std::to_string(previous.pitch);
+    if (!ExpectSameCounts(expected, actual, context)) {
+      return;
+    }
+  }
+}
+
+// A pixel is dead from DEAD_PIXEL_MIN_PERCENT of the frames on, counting the
+// frame pairs for stuck pixels. Two frames or fewer can't tell stuck pixels.
+void TestIsDead() {
+  struct {
+    int frame_count;
+    uint16_t outlier_count;
+    uint16_t stuck_count;
+    bool dead;
+  } cases[] = {
+    { 10, 8, 0, false },
+    { 10, 9, 0, true },
+    { 10, 0, 7, false },
+    { 10, 0, 8, true },
+    { 100, 89, 88, false },
+    { 100, 90, 0, true },
+    { 100, 0, 89, true },
+    { 1, 0, 0, false },
+    { 1, 1, 0, true },
+    { 1, 0, 1, false },
+    { 2, 0, 1, false },
+    { 2, 1, 0, true },
+    { 3, 1, 0, false },
+    { 3, 0, 1, true },
+    { 3, 2, 0, true },
+  };
+  DeadPixelStats stats(1, 1);
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    stats.outlier_counts[0] = cases[i].outlier_count;
+    stats.stuck_counts[0] = cases[i].stuck_count;
+    EXPECT_TRUE(stats.IsDead(0, cases[i].frame_count) == cases[i].dead, "case " + std::to_string(i));
+  }
+}
+
+} // namespace
+
+void RegisterDeadPixelStatsTests() {
+  const int bytes_per_pixel[] = { 1, 3, 4 };
+  for (size_t b = 0; b < sizeof(bytes_per_pixel) / sizeof(bytes_per_pixel[0]); b++) {
+    int bpp = bytes_per_pixel[b];
+    std::string suffix = "/bpp:" + std::to_string(bpp);
+    RegisterTest("DeadPixelStats/RandomClips" + suffix, [=]() {
+      TestRandomClips(bpp);
+    });
+    RegisterTest("DeadPixelStats/Outliers" + suffix, [=]() {
+      TestOutliers(bpp);
+    });
+    RegisterTest("DeadPixelStats/Stuck" + suffix, [=]() {
+      TestStuck(bpp);
+    });
+    RegisterTest("DeadPixelStats/PreviousPitch" + suffix, [=]() {
+      TestPreviousPitch(bpp);
+    });
+  }
+  RegisterTest("DeadPixelStats/IsDead", TestIsDead);
+}
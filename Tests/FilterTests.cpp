@@ -0,0 +1,18 @@
+// FilterTests.cpp : Unit tests of the HealDeadPixels and KelvinColorShift cores.
+//
+// Every SIMD kernel is compared with a scalar reference on random data. Runs
+// without an AviSynth host, see CMakeLists.txt.
+
+#include "FilterTests.h"
+
+int main(int argc, char** argv) {
+  RegisterColorShiftKernelTests();
+  RegisterShiftFrameTests();
+  RegisterDeadPixelStatsTests();
+  RegisterFrameHashTests();
+  RegisterFrameCacheTests();
+  RegisterHealKernelTests();
+  RegisterHealPlaneTilesTests();
+  RegisterRecipeCacheTests();
+  return RunTests(argc, argv);
+}
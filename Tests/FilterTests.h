@@ -0,0 +1,34 @@
+// FilterTests.h : Test groups of the filters_core library, registered by main.
+//
+
+#pragma once
+
+#include "TestRunner.h"
+
+// Row kernels against the RGB48 reference, blend and channel sum kernels
+// against the scalar ones, see ColorShiftKernelTests.cpp.
+void RegisterColorShiftKernelTests();
+
+// SIMD heal kernels against the scalar ones, see HealKernelTests.cpp.
+void RegisterHealKernelTests();
+
+// Multithreaded healing against a single thread, see HealKernelTests.cpp.
+void RegisterHealPlaneTilesTests();
+
+// Heal recipe cache files read back, and rejected when damaged or stale, see
+// RecipeCacheTests.cpp.
+void RegisterRecipeCacheTests();
+
+// DetectDeadPixels counters against a per-pixel reference, see
+// DeadPixelStatsTests.cpp.
+void RegisterDeadPixelStatsTests();
+
+// Whole-frame shifts against a per-pixel reference, see ColorShiftFrameTests.cpp.
+void RegisterShiftFrameTests();
+
+// Frame hash kernels against the scalar one and hashes of moved content, see
+// FrameHashTests.cpp.
+void RegisterFrameHashTests();
+
+// Eviction and capacity of the frame cache, see FrameHashTests.cpp.
+void RegisterFrameCacheTests();
@@ -0,0 +1,249 @@
+// FrameHashTests.cpp : Frame hash kernels against the scalar one, and the
+// frame cache of KelvinColorShift.
+//
+
+#include "FilterTests.h"
+#include "ColorShiftFrame.h"
+#include "CpuFeatures.h"
+#include "FrameCache.h"
+#include "FrameHash.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Random stripe runs and planes per kernel.
+#define HASH_TEST_RUNS 2000
+#define HASH_TEST_PLANES 200
+
+namespace {
+
+std::string LanesContext(int run, size_t first, size_t stripes) {
+  return "run " + std::to_string(run) + ", keys from " + std::to_string(first) +
+    ", " + std::to_string(stripes) + " stripes";
+}
+
+// Adds random runs of stripes, keyed from anywhere in a block, to random lanes
+// with both kernels. data ends right after the last stripe, so that reads past
+// it show up under AddressSanitizer.
+void TestHashStripes(HashStripesFunc hash_stripes, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  TestRandom random(5);
+  for (int run = 0; run < HASH_TEST_RUNS; run++) {
+    size_t first = random.Below(FRAME_HASH_BLOCK_STRIPES);
+    size_t stripes = random.Below(FRAME_HASH_BLOCK_STRIPES - (int)first + 1);
+    int offset = random.Below(32);
+    std::vector<unsigned char> data(offset + 32 * stripes);
+    random.Fill(data.data(), data.size());
+
+    uint64_t expected[4];
+    random.Fill((unsigned char*)expected, sizeof(expected));
+    uint64_t actual[4];
+    memcpy(actual, expected, sizeof(expected));
+    HashStripes_C(data.data() + offset, stripes, FRAME_HASH_SECRET + first, expected);
+    hash_stripes(data.data() + offset, stripes, FRAME_HASH_SECRET + first, actual);
+    if (!EXPECT_BYTES_EQ((const unsigned char*)expected, (const unsigned char*)actual, sizeof(expected),
+      LanesContext(run, first, stripes))) {
+      return;
+    }
+  }
+}
+
+// Hashes random planes, with rows spanning several blocks and partial stripes,
+// with both kernels. The padding between rows is not part of the hash, so
+// filling it differently must not change it.
+void TestHashPlanes(HashStripesFunc hash_stripes, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  TestRandom random(6);
+  for (int i = 0; i < HASH_TEST_PLANES; i++) {
+    int row_size = random.Between(1, 3 * 32 * FRAME_HASH_BLOCK_STRIPES);
+    int height = random.Between(1, 20);
+    int pitch = row_size + random.Below(64);
+    std::vector<unsigned char> plane((size_t)pitch * (height - 1) + row_size);
+    random.Fill(&plane[0], plane.size());
+
+    FrameHash expected(HashStripes_C);
+    expected.AddPlane(&plane[0], pitch, row_size, height);
+
+    std::vector<unsigned char> repadded((size_t)(pitch + 16) * (height - 1) + row_size);
+    random.Fill(&repadded[0], repadded.size());
+    for (int y = 0; y < height; y++) {
+      memcpy(&repadded[(size_t)y * (pitch + 16)], &plane[(size_t)y * pitch], row_size);
+    }
+    FrameHash actual(hash_stripes);
+    actual.AddPlane(&repadded[0], pitch + 16, row_size, height);
+
+    std::string context = std::to_string(row_size) + "x" + std::to_string(height) + ", pitch " + std::to_string(pitch);
+    if (!EXPECT_TRUE(expected.Finish() == actual.Finish(), context)) {
+      return;
+    }
+  }
+}
+
+// Hashes a plane the way KelvinColorShift::GetFrame does.
+uint64_t HashPlane(const std::vector<unsigned char>& plane, int pitch, int height, HashStripesFunc hash_stripes) {
+  ThreadPool pool(4);
+  std::vector<uint64_t> band_hashes;
+  HashPlaneBands(&plane[0], pitch, pitch, height, hash_stripes, pool, band_hashes);
+  return HashBandHashes(band_hashes, hash_stripes);
+}
+
+// A block_size byte white block at byte x of every row of a black plane.
+std::vector<unsigned char> BlockPlane(int pitch, int height, int x, int block_size) {
+  std::vector<unsigned char> plane((size_t)pitch * height, 0);
+  for (int y = 0; y < height; y++) {
+    memset(&plane[(size_t)y * pitch + x], 255, block_size);
+  }
+  return plane;
+}
+
+// Content moving sideways over a flat background only reorders the stripes
+// of the rows, which must still change the hash: an RGB32 block moved by 8
+// pixels and a luma block moved by 32, at 1080p. Also swaps two random
+// stripes of random rows.
+void TestMovedBlock(HashStripesFunc hash_stripes, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  int rgb32_pitch = 1920 * 4;
+  uint64_t from = HashPlane(BlockPlane(rgb32_pitch, 1080, 64 * 4, 32), rgb32_pitch, 1080, hash_stripes);
+  uint64_t to = HashPlane(BlockPlane(rgb32_pitch, 1080, 72 * 4, 32), rgb32_pitch, 1080, hash_stripes);
+  EXPECT_TRUE(from != to, "RGB32 block moved from x=64 to x=72");
+
+  from = HashPlane(BlockPlane(1920, 1080, 64, 32), 1920, 1080, hash_stripes);
+  to = HashPlane(BlockPlane(1920, 1080, 96, 32), 1920, 1080, hash_stripes);
+  EXPECT_TRUE(from != to, "luma block moved from x=64 to x=96");
+
+  TestRandom random(8);
+  for (int i = 0; i < HASH_TEST_PLANES; i++) {
+    int stripes = random.Between(2, 3 * FRAME_HASH_BLOCK_STRIPES);
+    std::vector<unsigned char> row(32 * stripes);
+    random.Fill(&row[0], row.size());
+    int a = random.Below(stripes);
+    int b = random.Below(stripes);
+    if (memcmp(&row[32 * a], &row[32 * b], 32) == 0) {
+      continue;
+    }
+
+    FrameHash original(hash_stripes);
+    original.AddRow(&row[0], (int)row.size());
+    std::vector<unsigned char> swapped(row);
+    memcpy(&swapped[32 * a], &row[32 * b], 32);
+    memcpy(&swapped[32 * b], &row[32 * a], 32);
+    FrameHash reordered(hash_stripes);
+    reordered.AddRow(&swapped[0], (int)swapped.size());
+    if (!EXPECT_TRUE(original.Finish() != reordered.Finish(),
+      "stripes " + std::to_string(a) + " and " + std::to_string(b) + " of " + std::to_string(stripes) + " swapped")) {
+      return;
+    }
+  }
+}
+
+FrameCacheKey CacheKey(uint64_t hash, int temp) {
+  FrameCacheKey key = { hash, temp };
+  return key;
+}
+
+// Frames are ints here, the cache only copies them around.
+bool IsCached(FrameCache<int>& cache, uint64_t hash, int expected) {
+  int frame = -1;
+  return cache.Lookup(CacheKey(hash, 6500), frame) && frame == expected;
+}
+
+void TestCacheEviction() {
+  FrameCache<int> cache(3);
+  cache.Insert(CacheKey(1, 6500), 10, 1);
+  cache.Insert(CacheKey(2, 6500), 20, 1);
+  cache.Insert(CacheKey(3, 6500), 30, 1);
+
+  // the lookup makes 1 the most recently used, so 2 goes first
+  EXPECT_TRUE(IsCached(cache, 1, 10), "1 before eviction");
+  cache.Insert(CacheKey(4, 6500), 40, 1);
+  EXPECT_TRUE(!IsCached(cache, 2, 20), "2 evicted");
+  EXPECT_TRUE(IsCached(cache, 1, 10), "1 kept");
+  EXPECT_TRUE(IsCached(cache, 3, 30), "3 kept");
+  EXPECT_TRUE(IsCached(cache, 4, 40), "4 cached");
+
+  // the lookups above leave 1 the least recently used
+  cache.Insert(CacheKey(5, 6500), 50, 1);
+  EXPECT_TRUE(!IsCached(cache, 1, 10), "1 evicted");
+  EXPECT_TRUE(IsCached(cache, 4, 40), "4 kept");
+  EXPECT_TRUE(IsCached(cache, 5, 50), "5 cached");
+
+  // the temperature is part of the key
+  int frame = -1;
+  EXPECT_TRUE(!cache.Lookup(CacheKey(5, 3200), frame), "5 at another temperature");
+
+  // a second insert of a key keeps the first frame
+  cache.Insert(CacheKey(5, 6500), 55, 1);
+  EXPECT_TRUE(IsCached(cache, 5, 50), "5 inserted twice");
+}
+
+void TestCacheCapacity() {
+  FrameCache<int> cache(100);
+  cache.Insert(CacheKey(1, 6500), 10, 101);
+  EXPECT_TRUE(!IsCached(cache, 1, 10), "frame larger than the capacity");
+
+  cache.Insert(CacheKey(2, 6500), 20, 40);
+  cache.Insert(CacheKey(3, 6500), 30, 40);
+  cache.Insert(CacheKey(4, 6500), 40, 20);
+  EXPECT_TRUE(IsCached(cache, 2, 20), "2 fills the cache with 3 and 4");
+
+  // 3 and 4 are the least recently used, making room takes both
+  cache.Insert(CacheKey(5, 6500), 50, 60);
+  EXPECT_TRUE(!IsCached(cache, 3, 30), "3 evicted");
+  EXPECT_TRUE(!IsCached(cache, 4, 40), "4 evicted");
+  EXPECT_TRUE(IsCached(cache, 2, 20), "2 kept");
+  EXPECT_TRUE(IsCached(cache, 5, 50), "5 cached");
+
+  // a frame of exactly the capacity empties the cache
+  cache.Insert(CacheKey(6, 6500), 60, 100);
+  EXPECT_TRUE(!IsCached(cache, 2, 20), "2 evicted");
+  EXPECT_TRUE(!IsCached(cache, 5, 50), "5 evicted");
+  EXPECT_TRUE(IsCached(cache, 6, 60), "6 cached");
+}
+
+} // namespace
+
+void RegisterFrameHashTests() {
+  struct {
+    const char* name;
+    HashStripesFunc hash_stripes;
+    bool (*supported)();
+  } kernels[] = {
+    { "C", HashStripes_C, NULL },
+    { "SSE2", HashStripes_SSE2, NULL },
+    { "AVX2", HashStripes_AVX2, IsAVX2Supported },
+  };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    HashStripesFunc hash_stripes = kernels[k].hash_stripes;
+    bool (*supported)() = kernels[k].supported;
+    if (hash_stripes != HashStripes_C) {
+      RegisterTest(std::string("FrameHash/HashStripes/") + kernels[k].name, [=]() {
+        TestHashStripes(hash_stripes, supported);
+      });
+      RegisterTest(std::string("FrameHash/Planes/") + kernels[k].name, [=]() {
+        TestHashPlanes(hash_stripes, supported);
+      });
+    }
+    RegisterTest(std::string("FrameHash/MovedBlock/") + kernels[k].name, [=]() {
+      TestMovedBlock(hash_stripes, supported);
+    });
+  }
+}
+
+void RegisterFrameCacheTests() {
+  RegisterTest("FrameCache/Eviction", TestCacheEviction);
+  RegisterTest("FrameCache/Capacity", TestCacheCapacity);
+}
@@ -0,0 +1,286 @@
+// HealKernelTests.cpp : HealDeadPixels kernels against the scalar ones.
+//
+
+#include "FilterTests.h"
+#include "CpuFeatures.h"
+#include "HealKernels.h"
+#include "HealRecipes.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Random planes per kernel.
+#define HEAL_TEST_PLANES 200
+
+// Random planes per thread count healed by HealPlaneTiles, large enough to
+// span several tiles each way.
+#define TILES_TEST_PLANES 40
+
+namespace {
+
+// A random plane with a random mask and the recipes healing it. The plane
+// buffer ends right after the last pixel, as AviSynth is only required to
+// allocate, so that reads past it show up under AddressSanitizer.
+struct HealTestPlane {
+  PlaneLayout layout;
+  std::unique_ptr<DeadPixelMask> mask;
+  PixelHealRecipes recipes;
+  CompiledPixelHealRecipes compiled;
+  std::vector<unsigned char> data;
+
+  size_t PlaneSize() const {
+    return (size_t)layout.pitch * (layout.height - 1) + (size_t)layout.width * layout.bytes_per_pixel;
+  }
+
+  std::string Describe() const {
+    return std::to_string(layout.width) + "x" + std::to_string(layout.height) +
+      ", pitch " + std::to_string(layout.pitch) + ", " + std::to_string(recipes.size()) + " dead pixels" +
+      (layout.bottom_up ? ", bottom-up" : "");
+  }
+};
+
+// Marks about fraction of the pixels dead, plus a few along the frame border
+// where the replacements are cut off on one or two sides.
+void FillMask(DeadPixelMask& mask, double fraction, TestRandom& random) {
+  int width = mask.GetWidth();
+  int height = mask.GetHeight();
+  int threshold = (int)(fraction * 65536);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      bool border = (x == 0 || y == 0 || x == width - 1 || y == height - 1);
+      if (random.Below(65536) < threshold || (border && random.Below(4) == 0)) {
+        mask.SetDead(x, y);
+      }
+    }
+  }
+}
+
+// width x height pixels of bytes_per_pixel bytes, rows padded by up to
+// max_padding bytes; a padding of 0 puts the last pixel of the plane right at
+// the end of the buffer.
+std::unique_ptr<HealTestPlane> MakeTestPlane(
+  int width,
+  int height,
+  int bytes_per_pixel,
+  int max_padding,
+  double fraction,
+  TestRandom& random
+  ) {
+  std::unique_ptr<HealTestPlane> plane(new HealTestPlane());
+  plane->layout.width = width;
+  plane->layout.height = height;
+  plane->layout.pitch = width * bytes_per_pixel + random.Below(max_padding + 1);
+  plane->layout.bytes_per_pixel = bytes_per_pixel;
+  plane->layout.bottom_up = (random.Below(2) == 0);
+
+  plane->mask.reset(new DeadPixelMask(width, height));
+  FillMask(*plane->mask, fraction, random);
+  GeneratePixelHealRecipes(*plane->mask, plane->recipes);
+  plane->compiled.Compile(plane->recipes, plane->layout);
+
+  plane->data.resize(plane->PlaneSize());
+  random.Fill(&plane->data[0], plane->data.size());
+  return plane;
+}
+
+std::unique_ptr<HealTestPlane> RandomTestPlane(int bytes_per_pixel, TestRandom& random) {
+  static const double fractions[] = { 0.001, 0.01, 0.05, 0.2, 0.6 };
+  int width = random.Between(1, 90);
+  int height = random.Between(1, 70);
+  double fraction = fractions[random.Below((int)(sizeof(fractions) / sizeof(fractions[0])))];
+  return MakeTestPlane(width, height, bytes_per_pixel, 16, fraction, random);
+}
+
+// Heals the plane in place and out of place with both kernels and compares
+// the results byte by byte.
+bool ExpectSameHeal(const HealTestPlane& plane, HealPixelsFunc reference, HealPixelsFunc heal_pixels) {
+  const std::vector<unsigned char>& src = plane.data;
+  size_t count = plane.recipes.size();
+
+  std::vector<unsigned char> expected(src);
+  std::vector<unsigned char> actual(src);
+  reference(&expected[0], &expected[0], plane.recipes, plane.compiled, 0, count);
+  heal_pixels(&actual[0], &actual[0], plane.recipes, plane.compiled, 0, count);
+  if (!EXPECT_BYTES_EQ(&expected[0], &actual[0], src.size(), "in place, " + plane.Describe())) {
+    return false;
+  }
+
+  expected.assign(src.size(), 0);
+  actual.assign(src.size(), 0);
+  reference(&src[0], &expected[0], plane.recipes, plane.compiled, 0, count);
+  heal_pixels(&src[0], &actual[0], plane.recipes, plane.compiled, 0, count);
+  return EXPECT_BYTES_EQ(&expected[0], &actual[0], src.size(), "out of place, " + plane.Describe());
+}
+
+void TestHealKernel(HealPixelsFunc reference, HealPixelsFunc heal_pixels, int bytes_per_pixel, bool (*supported)()) {
+  if (supported && !supported()) {
+    SkipTest("not supported by this CPU");
+    return;
+  }
+
+  TestRandom random(3 + bytes_per_pixel);
+  for (int i = 0; i < HEAL_TEST_PLANES; i++) {
+    std::unique_ptr<HealTestPlane> plane = RandomTestPlane(bytes_per_pixel, random);
+    if (!ExpectSameHeal(*plane, reference, heal_pixels)) {
+      return;
+    }
+  }
+}
+
+// The 32-bit reads of the replacements of every dead pixel up to gather_limit
+// have to stay inside the plane, and the pixels past it, which the kernels
+// heal one byte at a time, have to come out the same. Unpadded planes put
+// dead pixels right at the end of the buffer.
+void TestGatherLimit(HealPixelsFunc reference, HealPixelsFunc heal_pixels, int bytes_per_pixel, bool (*supported)()) {
+  TestRandom random(7 + bytes_per_pixel);
+  for (int i = 0; i < HEAL_TEST_PLANES; i++) {
+    int width = random.Between(1, 40);
+    int height = random.Between(1, 2 * MAX_REPLACEMENT_DISTANCE + 2);
+    std::unique_ptr<HealTestPlane> plane = MakeTestPlane(width, height, bytes_per_pixel, random.Below(2) ? 0 : 3,
+      0.3, random);
+    const CompiledPixelHealRecipes& compiled = plane->compiled;
+    long long plane_size = (long long)plane->PlaneSize();
+
+    for (size_t p = 0; p < plane->recipes.size(); p++) {
+      if (compiled.pixel_offsets[p] > compiled.gather_limit) {
+        continue;
+      }
+      for (uint32_t j = plane->recipes.starts[p]; j < plane->recipes.starts[p + 1]; j++) {
+        long long end = (long long)compiled.pixel_offsets[p] + compiled.offsets[j] + 4;
+        if (!EXPECT_TRUE(end <= plane_size, "dead pixel " + std::to_string(p) + ", " + plane->Describe())) {
+          return;
+        }
+      }
+    }
+
+    if (!supported || supported()) {
+      if (!ExpectSameHeal(*plane, reference, heal_pixels)) {
+        return;
+      }
+    }
+  }
+}
+
+// Checks in byte offsets what Compile works out in pixels: every 32-bit read
+// of a gathered replacement stays within its row and takes in no byte of a
+// dead pixel of another tile.
+void TestGatherOwnership(int bytes_per_pixel) {
+  TestRandom random(13 + bytes_per_pixel);
+  for (int i = 0; i < TILES_TEST_PLANES; i++) {
+    int width = random.Between(1, 3 * RECIPE_TILE_SIZE);
+    int height = random.Between(1, 3 * RECIPE_TILE_SIZE);
+    std::unique_ptr<HealTestPlane> plane = MakeTestPlane(width, height, bytes_per_pixel, random.Below(2) ? 0 : 3,
+      i % 2 ? 0.3 : 0.05, random);
+    const PlaneLayout& layout = plane->layout;
+    const CompiledPixelHealRecipes& compiled = plane->compiled;
+    int row_size = layout.width * bytes_per_pixel;
+    int tiles_per_row = (layout.width + RECIPE_TILE_SIZE - 1) / RECIPE_TILE_SIZE;
+
+    for (size_t p = 0; p < plane->recipes.size(); p++) {
+      if (compiled.pixel_offsets[p] > compiled.gather_limit || compiled.byte_reads[p]) {
+        continue;
+      }
+      int tile = (plane->recipes.frame_y[p] / RECIPE_TILE_SIZE) * tiles_per_row +
+        plane->recipes.frame_x[p] / RECIPE_TILE_SIZE;
+      for (uint32_t j = plane->recipes.starts[p]; j < plane->recipes.starts[p + 1]; j++) {
+        int read = compiled.pixel_offsets[p] + compiled.offsets[j];
+        for (int b = read + bytes_per_pixel; b < read + 4; b++) {
+          bool same_row = (b / layout.pitch == read / layout.pitch);
+          bool foreign = false;
+          if (same_row && b % layout.pitch < row_size) {
+            int x = (b % layout.pitch) / bytes_per_pixel;
+            int y = layout.bottom_up ? b / layout.pitch : layout.height - 1 - b / layout.pitch;
+            foreign = plane->mask->IsDead(x, y) &&
+              (y / RECIPE_TILE_SIZE) * tiles_per_row + x / RECIPE_TILE_SIZE != tile;
+          }
+          if (!same_row || foreign) {
+            ReportFailure(__FILE__, __LINE__, std::string(same_row ? "dead pixel of another tile" : "next row") +
+              " read for dead pixel " + std::to_string(p) + ", byte " + std::to_string(b) + ", " +
+              plane->Describe());
+            return;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Heals random planes of several tiles with a single thread and with threads
+// threads. Dense masks give recipes reaching into the neighboring tiles, which
+// another thread heals at the same time.
+void TestHealPlaneTiles(int bytes_per_pixel, int threads) {
+  static const double fractions[] = { 0.001, 0.02, 0.2, 0.5 };
+  HealPixelsFunc heal_pixels = GetHealPixelsFunc(GetCpuFlags(), bytes_per_pixel);
+  ThreadPool serial(1);
+  ThreadPool parallel(threads);
+
+  TestRandom random(11 * threads + bytes_per_pixel);
+  for (int i = 0; i < TILES_TEST_PLANES; i++) {
+    int width = random.Between(1, 5 * RECIPE_TILE_SIZE);
+    int height = random.Between(1, 4 * RECIPE_TILE_SIZE);
+    double fraction = fractions[i % (int)(sizeof(fractions) / sizeof(fractions[0]))];
+    std::unique_ptr<HealTestPlane> plane = MakeTestPlane(width, height, bytes_per_pixel, 16, fraction, random);
+
+    std::vector<unsigned char> expected(plane->data);
+    std::vector<unsigned char> actual(plane->data);
+    HealPlaneTiles(&expected[0], plane->recipes, plane->compiled, heal_pixels, serial);
+    HealPlaneTiles(&actual[0], plane->recipes, plane->compiled, heal_pixels, parallel);
+    if (!EXPECT_TRUE(memcmp(&expected[0], &actual[0], actual.size()) == 0, plane->Describe())) {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+void RegisterHealKernelTests() {
+  struct {
+    const char* name;
+    HealPixelsFunc reference;
+    HealPixelsFunc heal_pixels;
+    int bytes_per_pixel;
+    bool (*supported)();
+  } kernels[] = {
+    { "Plane/AVX2", HealPlanePixels_C, HealPlanePixels_AVX2, 1, IsAVX2Supported },
+    { "RGB24/AVX2", HealPixels_C, HealPixels_AVX2, 3, IsAVX2Supported },
+    { "RGB32/C", HealPixels_C, HealPixelsRGB32_C, 4, NULL },
+    { "RGB32/AVX2", HealPixels_C, HealPixelsRGB32_AVX2, 4, IsAVX2Supported },
+    { "RGB32/AVX2-BGR", HealPixels_C, HealPixels_AVX2, 4, IsAVX2Supported },
+  };
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    HealPixelsFunc reference = kernels[k].reference;
+    HealPixelsFunc heal_pixels = kernels[k].heal_pixels;
+    int bytes_per_pixel = kernels[k].bytes_per_pixel;
+    bool (*supported)() = kernels[k].supported;
+    RegisterTest(std::string("HealKernels/RandomPlanes/") + kernels[k].name, [=]() {
+      TestHealKernel(reference, heal_pixels, bytes_per_pixel, supported);
+    });
+    RegisterTest(std::string("HealKernels/GatherLimit/") + kernels[k].name, [=]() {
+      TestGatherLimit(reference, heal_pixels, bytes_per_pixel, supported);
+    });
+  }
+}
+
+void RegisterHealPlaneTilesTests() {
+  RegisterTest("HealPlaneTiles/GatherOwnership/bpp:1", []() {
+    TestGatherOwnership(1);
+  });
+  RegisterTest("HealPlaneTiles/GatherOwnership/bpp:3", []() {
+    TestGatherOwnership(3);
+  });
+
+  const int bytes_per_pixel[] = { 1, 3, 4 };
+  const int threads[] = { 2, 4, 8 };
+  for (size_t b = 0; b < sizeof(bytes_per_pixel) / sizeof(bytes_per_pixel[0]); b++) {
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+      int bpp = bytes_per_pixel[b];
+      int thread_count = threads[t];
+      RegisterTest("HealPlaneTiles/bpp:" + std::to_string(bpp) + "/threads:" + std::to_string(thread_count), [=]() {
+        TestHealPlaneTiles(bpp, thread_count);
+      });
+    }
+  }
+}
@@ -0,0 +1,238 @@
+// RecipeCacheTests.cpp : Heal recipe cache files written and read back, and
+// the damaged or mismatching ones that must be rejected.
+//
+
+#include "FilterTests.h"
+#include "HealRecipes.h"
+#include "RecipeCacheFormat.h"
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Random masks written to a cache and read back.
+#define CACHE_TEST_MASKS 50
+
+namespace {
+
+RecipeCacheKey CacheKey(int width, int height) {
+  RecipeCacheKey key = { 0x0123456789abcdefULL, width, height };
+  return key;
+}
+
+// The recipes of a width x height mask with about fraction of the pixels dead.
+PixelHealRecipes RandomRecipes(int width, int height, double fraction, TestRandom& random) {
+  DeadPixelMask mask(width, height);
+  int threshold = (int)(fraction * 65536);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      if (random.Below(65536) < threshold) {
+        mask.SetDead(x, y);
+      }
+    }
+  }
+  PixelHealRecipes recipes;
+  GeneratePixelHealRecipes(mask, recipes);
+  return recipes;
+}
+
+// The recipes of a single dead pixel at (x, y).
+PixelHealRecipes DeadPixelRecipes(int width, int height, int x, int y) {
+  DeadPixelMask mask(width, height);
+  mask.SetDead(x, y);
+  PixelHealRecipes recipes;
+  GeneratePixelHealRecipes(mask, recipes);
+  return recipes;
+}
+
+template<typename T>
+bool ExpectSameArray(const std::vector<T>& expected, const std::vector<T>& actual, const std::string& context) {
+  return EXPECT_TRUE(expected.size() == actual.size(), context + ", size") &&
+    (expected.empty() || EXPECT_BYTES_EQ((const unsigned char*)expected.data(), (const unsigned char*)actual.data(),
+      expected.size() * sizeof(T), context));
+}
+
+bool ExpectSameRecipes(const PixelHealRecipes& expected, const PixelHealRecipes& actual, const std::string& context) {
+  return ExpectSameArray(expected.frame_x, actual.frame_x, "frame_x, " + context) &&
+    ExpectSameArray(expected.frame_y, actual.frame_y, "frame_y, " + context) &&
+    ExpectSameArray(expected.starts, actual.starts, "starts, " + context) &&
+    ExpectSameArray(expected.weights, actual.weights, "weights, " + context) &&
+    ExpectSameArray(expected.offset_x, actual.offset_x, "offset_x, " + context) &&
+    ExpectSameArray(expected.offset_y, actual.offset_y, "offset_y, " + context);
+}
+
+// Reading data must fail and leave no recipes behind, even into recipes that
+// held some before.
+bool ExpectRejected(const std::vector<unsigned char>& data, const RecipeCacheKey& key, const std::string& context) {
+  TestRandom random(11);
+  PixelHealRecipes recipes = RandomRecipes(key.width, key.height, 0.05, random);
+  return EXPECT_TRUE(!ReadRecipeCache(data.data(), data.size(), key, recipes), context) &&
+    ExpectSameRecipes(PixelHealRecipes(), recipes, "left behind, " + context);
+}
+
+// Random masks of random sizes, some without dead pixels, read back into
+// recipes holding others.
+void TestRoundTrip() {
+  TestRandom random(31);
+  for (int i = 0; i < CACHE_TEST_MASKS; i++) {
+    int width = random.Between(1, 200);
+    int height = random.Between(1, 200);
+    double fraction = random.Below(5) == 0 ? 0 : random.Below(100) / 1000.0;
+    PixelHealRecipes recipes = RandomRecipes(width, height, fraction, random);
+    RecipeCacheKey key = CacheKey(width, height);
+    std::vector<unsigned char> data;
+    WriteRecipeCache(key, recipes, data);
+
+    std::string context = std::to_string(width) + "x" + std::to_string(height) + ", " +
+      std::to_string(recipes.size()) + " dead pixels";
+    size_t expected_size = sizeof(RecipeCacheHeader) +
+      recipes.size() * (2 * sizeof(int32_t) + sizeof(uint32_t)) + sizeof(uint32_t) +
+      recipes.weights.size() * (sizeof(uint16_t) + 2 * sizeof(int8_t));
+    if (!EXPECT_TRUE(data.size() == expected_size, "file size, " + context)) {
+      return;
+    }
+
+    PixelHealRecipes loaded = RandomRecipes(width, height, 0.05, random);
+    if (!EXPECT_TRUE(ReadRecipeCache(data.data(), data.size(), key, loaded), context) ||
+      !ExpectSameRecipes(recipes, loaded, context)) {
+      return;
+    }
+  }
+}
+
+// Files written for another key or version, or cut short or extended.
+void TestHeader() {
+  TestRandom random(37);
+  RecipeCacheKey key = CacheKey(120, 90);
+  std::vector<unsigned char> data;
+  WriteRecipeCache(key, RandomRecipes(key.width, key.height, 0.02, random), data);
+
+  struct {
+    const char* name;
+    std::function<void(RecipeCacheHeader&)> change;
+  } header_cases[] = {
+    { "magic", [](RecipeCacheHeader& header) { header.magic[7] = 'X'; } },
+    { "version", [](RecipeCacheHeader& header) { header.version++; } },
+    { "max_replacement_pixels", [](RecipeCacheHeader& header) { header.max_replacement_pixels--; } },
+    { "max_replacement_distance", [](RecipeCacheHeader& header) { header.max_replacement_distance++; } },
+    { "pixel_count", [](RecipeCacheHeader& header) { header.pixel_count++; } },
+    { "pixel_count beyond the frame", [](RecipeCacheHeader& header) { header.pixel_count = 120 * 90 + 1; } },
+    { "replacement_count", [](RecipeCacheHeader& header) { header.replacement_count--; } },
+    { "replacement_count wrapping the file size", [](RecipeCacheHeader& header) {
+      header.replacement_count += 1ULL << 62; } },
+  };
+  for (size_t i = 0; i < sizeof(header_cases) / sizeof(header_cases[0]); i++) {
+    std::vector<unsigned char> changed(data);
+    RecipeCacheHeader header;
+    memcpy(&header, changed.data(), sizeof(header));
+    header_cases[i].change(header);
+    memcpy(changed.data(), &header, sizeof(header));
+    ExpectRejected(changed, key, header_cases[i].name);
+  }
+
+  RecipeCacheKey other_key = key;
+  other_key.mask_hash ^= 1;
+  ExpectRejected(data, other_key, "mask hash");
+  other_key = key;
+  other_key.width++;
+  ExpectRejected(data, other_key, "width");
+  other_key = key;
+  other_key.height--;
+  ExpectRejected(data, other_key, "height");
+
+  ExpectRejected(std::vector<unsigned char>(data.begin(), data.end() - 1), key, "last byte cut off");
+  ExpectRejected(std::vector<unsigned char>(data.begin(), data.begin() + sizeof(RecipeCacheHeader) - 1), key,
+    "header cut off");
+  ExpectRejected(std::vector<unsigned char>(), key, "empty file");
+  std::vector<unsigned char> extended(data);
+  extended.push_back(0);
+  ExpectRejected(extended, key, "extra byte");
+}
+
+// Well-formed files whose recipes would make GetFrame read or write outside
+// the frame. Each case starts from valid recipes, which must load.
+void TestInvalidRecipes() {
+  const int width = 64;
+  const int height = 48;
+  RecipeCacheKey key = CacheKey(width, height);
+  TestRandom random(41);
+  PixelHealRecipes many = RandomRecipes(width, height, 0.05, random);
+  // a dead pixel far from the border, and one at the left border
+  PixelHealRecipes center = DeadPixelRecipes(width, height, 32, 24);
+  PixelHealRecipes left = DeadPixelRecipes(width, height, 0, 24);
+
+  struct {
+    const char* name;
+    const PixelHealRecipes& recipes;
+    std::function<void(PixelHealRecipes&)> change;
+  } cases[] = {
+    { "frame_x negative", many, [](PixelHealRecipes& r) { r.frame_x[r.size() / 2] = -1; } },
+    { "frame_x at width", many, [](PixelHealRecipes& r) { r.frame_x[r.size() / 2] = width; } },
+    { "frame_y negative", many, [](PixelHealRecipes& r) { r.frame_y[r.size() / 2] = -1; } },
+    { "frame_y at height", many, [](PixelHealRecipes& r) { r.frame_y[r.size() / 2] = height; } },
+    { "first start", many, [](PixelHealRecipes& r) { r.starts[0] = 1; } },
+    { "last start", many, [](PixelHealRecipes& r) { r.starts[r.size()]--; } },
+    { "decreasing starts", many, [](PixelHealRecipes& r) {
+      size_t i = r.size() / 2;
+      r.starts[i] = r.starts[i + 1] + 1; } },
+    { "start past the last replacement", center, [](PixelHealRecipes& r) {
+      // two dead pixels sharing 4 replacements, the first one taking one more;
+      // reading it shows up under AddressSanitizer
+      r.frame_x.push_back(r.frame_x[0]);
+      r.frame_y.push_back(r.frame_y[0]);
+      r.weights.resize(4);
+      r.offset_x.resize(4);
+      r.offset_y.resize(4);
+      r.starts.assign(1, 0);
+      r.starts.push_back(5);
+      r.starts.push_back(4); } },
+    { "too many replacements", center, [](PixelHealRecipes& r) {
+      while (r.weights.size() <= MAX_REPLACEMENT_PIXELS) {
+        r.weights.push_back(r.weights[0]);
+        r.offset_x.push_back(r.offset_x[0]);
+        r.offset_y.push_back(r.offset_y[0]);
+      }
+      r.starts[1] = (uint32_t)r.weights.size(); } },
+    { "replacement too far", center, [](PixelHealRecipes& r) {
+      r.offset_x[0] = MAX_REPLACEMENT_DISTANCE / 2 + 1;
+      r.offset_y[0] = -(MAX_REPLACEMENT_DISTANCE / 2 + 1); } },
+    { "replacement left of the frame", left, [](PixelHealRecipes& r) {
+      r.offset_x[0] = -1;
+      r.offset_y[0] = 0; } },
+    { "replacement below the frame", left, [](PixelHealRecipes& r) {
+      r.frame_y[0] = 0;
+      r.offset_x[0] = 1;
+      r.offset_y[0] = -1; } },
+    { "replacement right of the frame", left, [](PixelHealRecipes& r) {
+      r.frame_x[0] = width - 1;
+      r.offset_x[0] = 1;
+      r.offset_y[0] = 0; } },
+    { "replacement above the frame", left, [](PixelHealRecipes& r) {
+      r.frame_y[0] = height - 1;
+      r.offset_x[0] = 1;
+      r.offset_y[0] = 1; } },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    std::vector<unsigned char> data;
+    WriteRecipeCache(key, cases[i].recipes, data);
+    PixelHealRecipes loaded;
+    if (!EXPECT_TRUE(ReadRecipeCache(data.data(), data.size(), key, loaded),
+      std::string("unchanged for ") + cases[i].name)) {
+      continue;
+    }
+
+    PixelHealRecipes changed = cases[i].recipes;
+    cases[i].change(changed);
+    WriteRecipeCache(key, changed, data);
+    ExpectRejected(data, key, cases[i].name);
+  }
+}
+
+} // namespace
+
+void RegisterRecipeCacheTests() {
+  RegisterTest("RecipeCache/RoundTrip", TestRoundTrip);
+  RegisterTest("RecipeCache/Header", TestHeader);
+  RegisterTest("RecipeCache/InvalidRecipes", TestInvalidRecipes);
+}
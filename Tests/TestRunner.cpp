@@ -0,0 +1,116 @@
+// TestRunner.cpp : Minimal unit test harness for the filters_core library.
+//
+
+#include "TestRunner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <regex>
+#include <vector>
+
+// Failures printed per test, the rest are only counted.
+#define MAX_PRINTED_FAILURES 10
+
+namespace {
+
+struct RegisteredTest {
+  std::string name;
+  std::function<void()> test;
+};
+
+std::vector<RegisteredTest>& Registry() {
+  static std::vector<RegisteredTest> tests;
+  return tests;
+}
+
+// state of the running test
+int failures = 0;
+bool skipped = false;
+std::string skip_reason;
+
+} // namespace
+
+void RegisterTest(const std::string& name, const std::function<void()>& test) {
+  RegisteredTest registered = { name, test };
+  Registry().push_back(registered);
+}
+
+void SkipTest(const std::string& reason) {
+  skipped = true;
+  skip_reason = reason;
+}
+
+void ReportFailure(const char* file, int line, const std::string& message) {
+  if (++failures <= MAX_PRINTED_FAILURES) {
+    fprintf(stderr, "%s:%d: failure: %s\n", file, line, message.c_str());
+  }
+}
+
+bool ExpectBytesEqual(
+  const unsigned char* expected,
+  const unsigned char* actual,
+  size_t size,
+  const std::string& context,
+  const char* file,
+  int line
+  ) {
+  for (size_t i = 0; i < size; i++) {
+    if (expected[i] != actual[i]) {
+      char message[128];
+      snprintf(message, sizeof(message), "byte %zu of %zu is %d, expected %d, ",
+        i, size, (int)actual[i], (int)expected[i]);
+      ReportFailure(file, line, message + context);
+      return false;
+    }
+  }
+  return true;
+}
+
+int RunTests(int argc, char** argv) {
+  std::regex filter(".*");
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--test_filter=", 14) == 0) {
+      filter = std::regex(arg + 14);
+    } else {
+      fprintf(stderr, "usage: %s [--test_filter=<regex>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  int run = 0;
+  int failed = 0;
+  for (size_t t = 0; t < Registry().size(); t++) {
+    const RegisteredTest& test = Registry()[t];
+    if (!std::regex_search(test.name, filter)) {
+      continue;
+    }
+
+    failures = 0;
+    skipped = false;
+    printf("[ RUN      ] %s\n", test.name.c_str());
+    fflush(stdout);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    test.test();
+    long long ms = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+    run++;
+    if (failures > 0) {
+      failed++;
+      printf("[  FAILED  ] %s, %d failures (%lld ms)\n", test.name.c_str(), failures, ms);
+    } else if (skipped) {
+      printf("[  SKIPPED ] %s, %s\n", test.name.c_str(), skip_reason.c_str());
+    } else {
+      printf("[       OK ] %s (%lld ms)\n", test.name.c_str(), ms);
+    }
+  }
+
+  if (run == 0) {
+    fprintf(stderr, "no test matches the filter\n");
+    return 1;
+  }
+  printf("%d tests, %d failed\n", run, failed);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+// TestRunner.h : Minimal unit test harness for the filters_core library.
+//
+// Tests register under a slash separated name and report failures through the
+// EXPECT_* macros. --test_filter=<regex> runs a subset, CMakeLists.txt adds one
+// ctest test per group of names.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Registers a test. It passes unless it reports a failure.
+void RegisterTest(const std::string& name, const std::function<void()>& test);
+
+// Marks the running test as skipped, for code the CPU can't run. The test
+// still has to return by itself.
+void SkipTest(const std::string& reason);
+
+// Records a failure of the running test. Only the first few failures of a test
+// are printed.
+void ReportFailure(const char* file, int line, const std::string& message);
+
+// Compares size bytes, reporting the first difference. Returns true if they
+// are equal so that loops can stop at the first failing case.
+bool ExpectBytesEqual(
+  const unsigned char* expected,
+  const unsigned char* actual,
+  size_t size,
+  const std::string& context,
+  const char* file,
+  int line
+);
+
+// Runs the registered tests selected by the command line. Returns the process
+// exit code.
+int RunTests(int argc, char** argv);
+
+#define EXPECT_TRUE(condition, context) \
+  ((condition) ? true : (ReportFailure(__FILE__, __LINE__, std::string(#condition) + ", " + (context)), false))
+
+#define EXPECT_BYTES_EQ(expected, actual, size, context) \
+  ExpectBytesEqual((expected), (actual), (size), (context), __FILE__, __LINE__)
+
+// xorshift32, deterministic so that failures reproduce
+class TestRandom {
+  uint32_t state;
+
+public:
+  explicit TestRandom(uint32_t seed) : state(seed ? seed : 1) {
+  }
+
+  uint32_t Next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // [0, n)
+  int Below(int n) {
+    return (int)(Next() % (uint32_t)n);
+  }
+
+  // [begin, end]
+  int Between(int begin, int end) {
+    return begin + Below(end - begin + 1);
+  }
+
+  void Fill(unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      data[i] = (unsigned char)Next();
+    }
+  }
+};
@@ -0,0 +1,115 @@
+// ThreadPool.h : Persistent worker threads for processing one frame in bands.
+//
+// A pool is created once per filter instance. ParallelFor hands out indices to
+// the workers and the calling thread, and returns once every index is done.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+  std::vector<std::thread> workers;
+
+  // serializes ParallelFor calls coming from different threads
+  std::mutex dispatch_mutex;
+
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  const std::function<void(int)>* task;
+  int task_count;
+  std::atomic<int> next_index;
+  int busy_workers;
+  unsigned generation;
+  bool stopping;
+
+public:
+  // thread_count includes the calling thread, 0 means one per hardware thread
+  explicit ThreadPool(int thread_count)
+    : task(NULL), task_count(0), busy_workers(0), generation(0), stopping(false) {
+    if (thread_count <= 0) {
+      thread_count = (int)std::thread::hardware_concurrency();
+    }
+    for (int i = 1; i < thread_count; i++) {
+      workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  int GetThreadCount() const {
+    return (int)workers.size() + 1;
+  }
+
+  // Calls fn(i) for every i in [0, count), possibly concurrently.
+  void ParallelFor(int count, const std::function<void(int)>& fn) {
+    if (workers.empty() || count <= 1) {
+      for (int i = 0; i < count; i++) {
+        fn(i);
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = &fn;
+      task_count = count;
+      next_index = 0;
+      busy_workers = (int)workers.size();
+      generation++;
+    }
+    work_ready.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return busy_workers == 0; });
+    task = NULL;
+  }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void RunTasks() {
+    for (int i = next_index++; i < task_count; i = next_index++) {
+      (*task)(i);
+    }
+  }
+
+  void WorkerLoop() {
+    unsigned seen_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+      if (stopping) {
+        return;
+      }
+      seen_generation = generation;
+
+      lock.unlock();
+      RunTasks();
+      lock.lock();
+
+      if (--busy_workers == 0) {
+        work_done.notify_one();
+      }
+    }
+  }
+};